@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""
+Generates large synthetic Lox sources for measuring the clox front end.
+
+    python3 bench/generate.py --shape mixed --lines 100000 > big.lox
+    ./clox --compile-only big.lox
+
+Shapes:
+    nesting      blocks, ifs and whiles nested many levels deep
+    locals       blocks that declare and use close to the 256-local limit
+    expressions  long arithmetic / logical expressions with deep parentheses
+    globals      many globals that are defined, read and reassigned
+    mixed        all of the above, interleaved
+
+The output stays inside the compiler's limits: at most 256 locals, a bounded vocabulary of
+numbers and global names so one chunk never needs more than 256 constants, and jumps shorter
+than 64 KiB. Every program also runs, so the same files work as interpreter benchmarks.
+"""
+
+import argparse
+import random
+import sys
+
+GLOBAL_NAMES = 150     # distinct global names; each one takes a constant slot.
+NUMBERS = 60           # distinct numeric literals, 0 .. NUMBERS - 1.
+MAX_LOCALS = 200       # below UINT8_COUNT, leaving room for nested blocks.
+MAX_NESTING = 40
+OPERATORS = ["+", "-", "*"]
+
+
+class Generator:
+    def __init__(self, seed):
+        self.random = random.Random(seed)
+        self.lines = []
+        self.defined = 0  # globals g0 .. g(defined - 1) exist.
+
+    def emit(self, depth, text):
+        self.lines.append("  " * depth + text)
+
+    def number(self):
+        return str(self.random.randrange(1, NUMBERS))
+
+    def global_name(self):
+        if self.defined == 0:
+            return self.number()
+        return "g%d" % self.random.randrange(self.defined)
+
+    def expression(self, operands, depth=0):
+        """A left-leaning chain of binary operators, with some parenthesized sub-expressions."""
+        parts = []
+        for _ in range(operands):
+            if depth < 4 and self.random.random() < 0.15:
+                parts.append("(" + self.expression(self.random.randint(2, 5), depth + 1) + ")")
+            else:
+                parts.append(self.random.choice([self.number(), self.global_name()]))
+        text = parts[0]
+        for part in parts[1:]:
+            text += " %s %s" % (self.random.choice(OPERATORS), part)
+        return text
+
+    def globals(self, depth):
+        if self.defined < GLOBAL_NAMES:
+            self.emit(depth, "var g%d = %s;" % (self.defined, self.expression(3)))
+            self.defined += 1
+        else:
+            name = "g%d" % self.random.randrange(GLOBAL_NAMES)
+            self.emit(depth, "%s = %s - %s;" % (name, self.global_name(), self.global_name()))
+
+    def locals(self, depth):
+        count = self.random.randint(MAX_LOCALS // 2, MAX_LOCALS)
+        self.emit(depth, "{")
+        for i in range(count):
+            init = self.number() if i == 0 else "l%d + %s" % (self.random.randrange(i), self.number())
+            self.emit(depth + 1, "var l%d = %s;" % (i, init))
+        for _ in range(count // 4):
+            a, b = self.random.randrange(count), self.random.randrange(count)
+            self.emit(depth + 1, "l%d = l%d * 2 - l%d;" % (a, b, a))
+        self.emit(depth, "}")
+
+    def expressions(self, depth):
+        self.emit(depth, "{")
+        self.emit(depth + 1, "var e = %s;" % self.expression(self.random.randint(20, 60)))
+        self.emit(depth + 1, "var c = e > %s and e < %s or !(e == %s);" %
+                  (self.number(), self.global_name(), self.number()))
+        self.emit(depth, "}")
+
+    def nesting(self, depth):
+        levels = self.random.randint(MAX_NESTING // 2, MAX_NESTING)
+        for level in range(levels):
+            kind = level % 3
+            if kind == 0:
+                self.emit(depth + level, "{")
+                self.emit(depth + level + 1, "var n%d = %s;" % (level, self.number()))
+            elif kind == 1:
+                self.emit(depth + level, "if (%s > %s) {" % (self.number(), self.number()))
+            else:
+                # runs at most once, so the generated program stays fast to execute.
+                self.emit(depth + level, "var w%d = true;" % level)
+                self.emit(depth + level, "while (w%d) {" % level)
+                self.emit(depth + level + 1, "w%d = false;" % level)
+        for level in reversed(range(levels)):
+            self.emit(depth + level, "}")
+
+    def generate(self, shape, target):
+        shapes = {
+            "nesting": self.nesting,
+            "locals": self.locals,
+            "expressions": self.expressions,
+            "globals": self.globals,
+        }
+        choices = list(shapes.values()) if shape == "mixed" else [shapes[shape]]
+
+        # globals are defined up front so every later reference is valid at runtime.
+        while self.defined < GLOBAL_NAMES:
+            self.globals(0)
+        while len(self.lines) < target:
+            self.random.choice(choices)(0)
+        self.emit(0, "print g0;")
+        return "\n".join(self.lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--shape", default="mixed",
+                        choices=["nesting", "locals", "expressions", "globals", "mixed"])
+    parser.add_argument("--lines", type=int, default=100000, help="approximate number of lines")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    sys.stdout.write(Generator(args.seed).generate(args.shape, args.lines))
+
+
+if __name__ == "__main__":
+    main()
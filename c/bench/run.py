@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""
+Runs the clox benchmark suite and reports timings as JSON.
+
+    make bench              # build, run, compare with bench/baseline.json
+    make bench-baseline     # build, run, save bench/baseline.json
+
+    python3 bench/run.py --clox build/release/clox --counter build/profile/clox \\
+        --baseline bench/baseline.json bench/*.lox
+
+Each benchmark is run --runs times after one warm-up run, and the report has the median,
+standard deviation and minimum wall time per benchmark. Instructions per second come from
+the number of bytecode instructions the benchmark executes, counted once with a
+PROFILE_OPCODES build (--counter); the programs are deterministic, so the count is exact.
+
+With --baseline, every benchmark whose median is more than --threshold slower than the
+baseline's median (and slower by more than both runs' noise) is reported as a regression,
+and the exit status is 1.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def run_once(clox, path):
+    start = time.perf_counter()
+    result = subprocess.run([clox, path], stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    seconds = time.perf_counter() - start
+    if result.returncode != 0:
+        sys.exit("%s failed on %s (exit %d):\n%s" %
+                 (clox, path, result.returncode, result.stderr.decode(errors="replace")))
+    return seconds
+
+
+def count_instructions(counter, path):
+    """Total executed instructions, from the opcode counts a PROFILE_OPCODES build writes."""
+    with tempfile.TemporaryDirectory() as directory:
+        profile = os.path.join(directory, "profile.json")
+        env = dict(os.environ, CLOX_PROFILE=profile)
+        subprocess.run([counter, path], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL,
+                       env=env, check=True)
+        with open(profile) as file:
+            return sum(opcode["count"] for opcode in json.load(file)["opcodes"])
+
+
+def measure(clox, counter, path, runs):
+    run_once(clox, path)  # warm up the page cache and the CPU.
+    times = [run_once(clox, path) for _ in range(runs)]
+    median = statistics.median(times)
+    result = {
+        "runs": runs,
+        "median": median,
+        "stddev": statistics.stdev(times) if runs > 1 else 0.0,
+        "min": min(times),
+    }
+    if counter is not None:
+        instructions = count_instructions(counter, path)
+        result["instructions"] = instructions
+        result["instructions_per_second"] = instructions / median
+    return result
+
+
+def compare(results, baseline, threshold):
+    """Returns the names of benchmarks that got slower than the baseline."""
+    regressions = []
+    for name, current in sorted(results.items()):
+        before = baseline.get(name)
+        if before is None:
+            print("%-16s new" % name, file=sys.stderr)
+            continue
+        change = current["median"] / before["median"] - 1
+        noise = current["stddev"] + before["stddev"]
+        slower = change > threshold and current["median"] - before["median"] > noise
+        if slower:
+            regressions.append(name)
+        print("%-16s %8.3f ms -> %8.3f ms  %+6.1f%%%s" %
+              (name, before["median"] * 1e3, current["median"] * 1e3, change * 100,
+               "  REGRESSION" if slower else ""), file=sys.stderr)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("benchmarks", nargs="+", help="Lox programs to run")
+    parser.add_argument("--clox", default="build/release/clox", help="binary to time")
+    parser.add_argument("--counter", help="PROFILE_OPCODES build, for instruction counts")
+    parser.add_argument("--runs", type=int, default=7)
+    parser.add_argument("--baseline", help="compare against this saved result")
+    parser.add_argument("--save-baseline", metavar="PATH", help="save the results here")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="relative slowdown that counts as a regression (default 0.05)")
+    args = parser.parse_args()
+
+    results = {}
+    for path in args.benchmarks:
+        name = os.path.splitext(os.path.basename(path))[0]
+        results[name] = measure(args.clox, args.counter, path, args.runs)
+
+    report = {"clox": args.clox, "benchmarks": results}
+    json.dump(report, sys.stdout, indent=2, sort_keys=True)
+    print()
+
+    if args.save_baseline:
+        with open(args.save_baseline, "w") as file:
+            json.dump(report, file, indent=2, sort_keys=True)
+            file.write("\n")
+        print("saved baseline to %s" % args.save_baseline, file=sys.stderr)
+
+    if args.baseline:
+        if not os.path.exists(args.baseline):
+            print("no baseline at %s; run `make bench-baseline` first" % args.baseline,
+                  file=sys.stderr)
+            return 0
+        with open(args.baseline) as file:
+            baseline = json.load(file)["benchmarks"]
+        regressions = compare(results, baseline, args.threshold)
+        if regressions:
+            print("regressions: %s" % ", ".join(regressions), file=sys.stderr)
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "memory.h"
@@ -8,6 +9,16 @@ void initChunk(Chunk* chunk) {
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
+    chunk->maxStackDepth = 0;
+    chunk->caches = NULL;
+    chunk->cacheCount = 0;
+    chunk->cacheCapacity = 0;
+    chunk->methodCaches = NULL;
+    chunk->methodCacheCount = 0;
+    chunk->methodCacheCapacity = 0;
+    chunk->switches = NULL;
+    chunk->switchCount = 0;
+    chunk->switchCapacity = 0;
     initValueArray(&chunk->constants);
 }
 
@@ -28,6 +39,13 @@ void freeChunk(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(int, chunk->lines, chunk->capacity);
     freeValueArray(&chunk->constants);
+    FREE_ARRAY(PropertyCache, chunk->caches, chunk->cacheCapacity);
+    FREE_ARRAY(MethodCache, chunk->methodCaches, chunk->methodCacheCapacity);
+    for (int i = 0; i < chunk->switchCount; i++) {
+        FREE_ARRAY(int, chunk->switches[i].targets, chunk->switches[i].count);
+        freeValueTable(&chunk->switches[i].labels);
+    }
+    FREE_ARRAY(SwitchTable, chunk->switches, chunk->switchCapacity);
     initChunk(chunk);
 }
 
@@ -41,4 +59,44 @@ int addConstant(Chunk* chunk, Value value) {
     */
     writeValueArray(&chunk->constants, value);
     return chunk->constants.count - 1;
-}
\ No newline at end of file
+}
+
+// an empty cache for one more property access; returns its index.
+int addPropertyCache(Chunk* chunk) {
+    if (chunk->cacheCapacity < chunk->cacheCount + 1) {
+        int oldCapacity = chunk->cacheCapacity;
+        chunk->cacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->caches = GROW_ARRAY(PropertyCache, chunk->caches, oldCapacity, chunk->cacheCapacity);
+    }
+
+    memset(&chunk->caches[chunk->cacheCount], 0, sizeof(PropertyCache));
+    return chunk->cacheCount++;
+}
+
+int addMethodCache(Chunk* chunk) {
+    if (chunk->methodCacheCapacity < chunk->methodCacheCount + 1) {
+        int oldCapacity = chunk->methodCacheCapacity;
+        chunk->methodCacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->methodCaches = GROW_ARRAY(MethodCache, chunk->methodCaches, oldCapacity, chunk->methodCacheCapacity);
+    }
+
+    memset(&chunk->methodCaches[chunk->methodCacheCount], 0, sizeof(MethodCache));
+    return chunk->methodCacheCount++;
+}
+
+// an empty table for one more switch statement; returns its index.
+int addSwitchTable(Chunk* chunk) {
+    if (chunk->switchCapacity < chunk->switchCount + 1) {
+        int oldCapacity = chunk->switchCapacity;
+        chunk->switchCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->switches = GROW_ARRAY(SwitchTable, chunk->switches, oldCapacity, chunk->switchCapacity);
+    }
+
+    SwitchTable* table = &chunk->switches[chunk->switchCount];
+    table->low = 0;
+    table->count = 0;
+    table->targets = NULL;
+    initValueTable(&table->labels);
+    table->defaultTarget = 0;
+    return chunk->switchCount++;
+}
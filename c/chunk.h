@@ -2,6 +2,7 @@
 #define clox_chunk_h
 
 #include "common.h"
+#include "table.h"
 #include "value.h"
 
 typedef enum {
@@ -20,6 +21,17 @@ typedef enum {
     OP_GET_GLOBAL,
     OP_DEFINE_GLOBAL,
     OP_SET_GLOBAL,
+    OP_GET_UPVALUE,
+    OP_SET_UPVALUE,
+    /*
+    OP_GET_PROPERTY / OP_SET_PROPERTY: name constant index(1 byte), property cache index(2 bytes).
+    */
+    OP_GET_PROPERTY,
+    OP_SET_PROPERTY,
+    OP_BUILD_ARRAY, // operand: element count. The elements are on the stack, first one lowest.
+    OP_BUILD_STRING, // operand: part count. Joins the parts' printed forms into one string.
+    OP_GET_INDEX,   // [array][index] -> element
+    OP_SET_INDEX,   // [array][index][value] -> value
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
@@ -29,13 +41,103 @@ typedef enum {
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,
+    // unchecked forms, emitted when the compiler has proven the operands are numbers.
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_NEGATE_NUM,
+    OP_GREATER_NUM,
+    OP_LESS_NUM,
     OP_PRINT,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
     OP_LOOP,
+    /*
+    OP_TABLE_SWITCH / OP_LOOKUP_SWITCH: switch table index(2 bytes). Pop the value and jump
+    forward to its case. The table form indexes an array by the value, the lookup form
+    hashes it; see SwitchTable.
+    */
+    OP_TABLE_SWITCH,
+    OP_LOOKUP_SWITCH,
+    OP_CALL,    // operand: argument count. The callee sits below its arguments on the stack.
+    OP_CALL_NUM, // OP_CALL whose arguments the compiler proved numbers; calls typed natives unchecked.
+    /*
+    OP_INVOKE: receiver.name(args) in one instruction, without creating a bound method.
+    name constant index(1 byte), argument count(1 byte), method cache index(2 bytes).
+    OP_SUPER_INVOKE: the same for super.name(args); the superclass is on top of the arguments.
+    */
+    OP_INVOKE,
+    OP_SUPER_INVOKE,
+    /*
+    OP_CLOSURE: function constant index, then one (isLocal, index) byte pair per upvalue.
+    isLocal 1: capture the enclosing function's local slot 'index'; 0: its upvalue 'index'.
+    */
+    OP_CLOSURE,
+    OP_CLOSE_UPVALUE, // move the top slot's captured variable to the heap, then pop it.
+    OP_CLASS,
+    OP_INHERIT, // copies the superclass's methods into the subclass on top of it.
+    OP_METHOD,  // adds the closure on top of the stack to the class below it.
+    OP_GET_SUPER, // name constant index; binds super.name to 'this'.
     OP_RETURN,  // this instruction will mean "return from the current func."
 } OpCode;
 
+#define PROPERTY_CACHE_WAYS 4 // shapes one property access remembers before it stops learning.
+
+/*
+Inline cache for one property access in the bytecode.
+Each entry says: for an instance of this shape, the field lives at this slot. A site that only
+ever sees one shape (monomorphic) hits on the first compare; one that sees a few (polymorphic)
+checks up to PROPERTY_CACHE_WAYS. Past that the site is megamorphic and misses take the slow path.
+*/
+typedef struct {
+    ObjShape* shape;
+    ObjShape* transition; // for a set that adds the field: the instance's shape after it. NULL otherwise.
+    int slot;
+} CacheEntry;
+
+typedef struct {
+    CacheEntry entries[PROPERTY_CACHE_WAYS];
+    int count;
+} PropertyCache;
+
+#define METHOD_CACHE_WAYS 4
+
+/*
+Inline cache for one method call site (OP_INVOKE / OP_SUPER_INVOKE).
+An entry says: a receiver of this class, whose shape has no field by the method's name,
+calls this function. The field check is why the shape is part of the key (a field shadows
+a method); super calls skip it and leave shape NULL. version must match the class's, so
+changing a class's methods makes every entry for it miss once and be looked up again.
+*/
+typedef struct {
+    ObjShape* shape;
+    ObjClass* klass;
+    uint32_t version;
+    ObjFunction* function;
+    ObjUpvalue** upvalues; // NULL if the method captures nothing.
+} MethodEntry;
+
+typedef struct {
+    MethodEntry entries[METHOD_CACHE_WAYS];
+    int count;
+} MethodCache;
+
+/*
+Where a switch statement jumps. Targets are offsets forward from the end of the instruction.
+OP_TABLE_SWITCH is for whole-number labels that fill most of a range: the target for
+value v is targets[v - low]; gaps in the range hold defaultTarget.
+OP_LOOKUP_SWITCH is for the rest: labels maps each label to its target, as a number.
+Labels are literals, so string labels are interned and the lookup compares them by identity.
+*/
+typedef struct {
+    int low;
+    int count;          // entries in targets; 0 for OP_LOOKUP_SWITCH.
+    int* targets;
+    ValueTable labels;  // filled in either way; the compiler builds targets from it.
+    int defaultTarget;  // no label matched: the default case, or past the switch.
+} SwitchTable;
+
 typedef struct {
     /*
     code: pointer to store some other data with instructions
@@ -48,11 +150,24 @@ typedef struct {
     uint8_t* code;
     int* lines; // store a separate array of integer that parallels the bytecode.
     ValueArray constants;
+    int maxStackDepth; // most values the code can have on the stack at once, computed by the compiler.
+    PropertyCache* caches; // one per property get/set in the code, filled in as it runs.
+    int cacheCount;
+    int cacheCapacity;
+    MethodCache* methodCaches; // one per method call site.
+    int methodCacheCount;
+    int methodCacheCapacity;
+    SwitchTable* switches; // one per switch statement.
+    int switchCount;
+    int switchCapacity;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
+int addPropertyCache(Chunk* chunk);
+int addMethodCache(Chunk* chunk);
+int addSwitchTable(Chunk* chunk);
 
 #endif
\ No newline at end of file
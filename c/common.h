@@ -5,8 +5,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
+// #define DEBUG_PRINT_CODE
+// #define DEBUG_TRACE_EXECUTION // printf tracing; see trace.h for the binary flight recorder.
+// #define PROFILE_OPCODES // per-opcode counts, pair counts and timing; see profile.h.
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
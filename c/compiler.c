@@ -4,18 +4,15 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "memory.h"
+#include "pipeline.h"
 #include "scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
-typedef struct {
-    Token current;
-    Token previous;
-    bool hadError;
-    bool panicMode;
-} Parser;
+typedef struct Parser Parser;
 
 typedef enum {
     PREC_NONE,
@@ -31,7 +28,7 @@ typedef enum {
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)(bool canAssign); // simple typedef for a function type that returns nothing.
+typedef void (*ParseFn)(Parser* parser, bool canAssign); // simple typedef for a function type that returns nothing.
 
 typedef struct {
     ParseFn prefix;
@@ -39,200 +36,530 @@ typedef struct {
     Precedence precedence;
 } ParseRule;
 
+/*
+Static types, for skipping the runtime operand checks in arithmetic.
+Only TYPE_NUMBER is acted on; the rest exist so joins (and/or) and '+' stay exact.
+
+A local is TYPE_NUMBER while every value assigned to it so far is a number.
+That can change later in the source (an assignment further down, or inside a loop body
+that runs before code compiled earlier), so anything proven through a local records
+which locals it relied on in a LocalSet. When a local loses TYPE_NUMBER, every
+instruction that relied on it is patched back to the checked opcode (same size),
+and so is every local whose own numberness came from it.
+*/
+typedef enum {
+    TYPE_UNKNOWN,
+    TYPE_NUMBER,
+    TYPE_BOOL,
+    TYPE_NIL,
+    TYPE_STRING,
+} StaticType;
+
+typedef struct {
+    uint64_t bits[UINT8_COUNT / 64];
+} LocalSet;
+
+typedef struct {
+    StaticType type;
+    LocalSet deps; // locals this type was proven through.
+} ExprType;
+
+// an unchecked instruction to undo if one of its deps stops being a number.
+typedef struct {
+    int offset;
+    uint8_t checked;
+    LocalSet deps;
+} ElidedCheck;
+
 typedef struct {
     Token name;
     int depth; // zero is global scope, one is the first top-level block ..
+    ExprType type; // join of every value assigned so far.
+    bool isCaptured; // some closure refers to it, so its slot is closed rather than popped.
 } Local;
 
+// where a closure gets a captured variable from: the enclosing function's local slot, or its upvalue.
 typedef struct {
+    uint8_t index;
+    bool isLocal;
+} Upvalue;
+
+// what the code being compiled belongs to. The top-level code is compiled into a function too.
+typedef enum {
+    TYPE_FUNCTION,
+    TYPE_INITIALIZER,
+    TYPE_METHOD,
+    TYPE_SCRIPT
+} FunctionType;
+
+/*
+One per function being compiled; they form a stack through enclosing, innermost on top.
+*/
+typedef struct Compiler {
+    struct Compiler* enclosing;
+    int nesting;           // functions around this one; 0 for the script.
+    ObjFunction* function; // the function the bytecode goes into.
+    FunctionType type;
+
     /* 
         In jlox, used a linked chain of "environment" HashMaps to track which local variables were currently in scope.
         For clox, a little closer to the metal.
     */
     Local locals[UINT8_COUNT];
     int localCount;
+    Upvalue upvalues[UINT8_COUNT]; // function->upvalueCount of them are in use.
     int scopeDepth;
+
+    /*
+    Operand stack bookkeeping, so the chunk can carry its maximum stack depth
+    and the VM can size the stack once instead of checking every push.
+    stackDepth: values on the stack after the last emitted instruction.
+    operandBytes: operand bytes still to come for the last opcode; emitByte() skips those.
+    reachable: false right after OP_JUMP / OP_LOOP / OP_RETURN. The next real instruction
+               is a jump target, and its depth is the depth at the jump (see patchJump()).
+    */
+    int stackDepth;
+    int operandBytes;
+    bool reachable;
+
+    ExprType lastType;   // type of the expression compiled last.
+    ExprType leftType;   // left operand, for the infix rule being called.
+    ElidedCheck* elided; // unchecked instructions that depend on locals.
+    int elidedCount;
+    int elidedCapacity;
 } Compiler;
 
-// ParseFn type is a simple typedef for a function type
-// that takes no arguments and returns nothing.
-typedef void (*ParseFn)();
+// one per class declaration being compiled, innermost on top; tells 'this' whether it is inside one.
+typedef struct ClassCompiler {
+    struct ClassCompiler* enclosing;
+    bool hasSuperclass; // whether 'super' means anything in its methods.
+} ClassCompiler;
+
+typedef struct {
+    int8_t stackEffect;   // values pushed minus values popped.
+    uint8_t operandBytes;
+} OpInfo;
+
+static const OpInfo opInfo[UINT8_COUNT] = {
+    [OP_CONSTANT]      = { 1, 1},
+    [OP_NIL]           = { 1, 0},
+    [OP_TRUE]          = { 1, 0},
+    [OP_FALSE]         = { 1, 0},
+    [OP_POP]           = {-1, 0},
+    [OP_GET_LOCAL]     = { 1, 1},
+    [OP_SET_LOCAL]     = { 0, 1},
+    [OP_GET_GLOBAL]    = { 1, 1},
+    [OP_DEFINE_GLOBAL] = {-1, 1},
+    [OP_SET_GLOBAL]    = { 0, 1},
+    [OP_GET_UPVALUE]   = { 1, 1},
+    [OP_SET_UPVALUE]   = { 0, 1},
+    [OP_GET_PROPERTY]  = { 0, 3},
+    [OP_SET_PROPERTY]  = {-1, 3},
+    [OP_BUILD_ARRAY]   = { 1, 1}, // arrayLiteral() pops the elements.
+    [OP_BUILD_STRING]  = { 1, 1}, // interpolation() pops the parts.
+    [OP_GET_INDEX]     = {-1, 0},
+    [OP_SET_INDEX]     = {-2, 0},
+    [OP_EQUAL]         = {-1, 0},
+    [OP_GREATER]       = {-1, 0},
+    [OP_LESS]          = {-1, 0},
+    [OP_ADD]           = {-1, 0},
+    [OP_SUBTRACT]      = {-1, 0},
+    [OP_MULTIPLY]      = {-1, 0},
+    [OP_DIVIDE]        = {-1, 0},
+    [OP_NOT]           = { 0, 0},
+    [OP_NEGATE]        = { 0, 0},
+    [OP_PRINT]         = {-1, 0},
+    [OP_JUMP]          = { 0, 2},
+    [OP_JUMP_IF_FALSE] = { 0, 2},
+    [OP_LOOP]          = { 0, 2},
+    [OP_TABLE_SWITCH]  = {-1, 2},
+    [OP_LOOKUP_SWITCH] = {-1, 2},
+    [OP_CALL]          = { 0, 1}, // the arguments are popped by call(); the callee becomes the result.
+    [OP_CALL_NUM]      = { 0, 1},
+    [OP_INVOKE]        = { 0, 4}, // like OP_CALL, the receiver becomes the result; emitInvoke pops the arguments.
+    [OP_SUPER_INVOKE]  = {-1, 4}, // and the superclass on top of them.
+    [OP_CLOSURE]       = { 1, 1}, // plus two bytes per upvalue; function() accounts for those.
+    [OP_CLOSE_UPVALUE] = {-1, 0},
+    [OP_CLASS]         = { 1, 1},
+    [OP_INHERIT]       = {-1, 0},
+    [OP_METHOD]        = {-1, 1},
+    [OP_GET_SUPER]     = {-1, 1},
+    [OP_RETURN]        = {-1, 0},
+    [OP_ADD_NUM]       = {-1, 0},
+    [OP_SUBTRACT_NUM]  = {-1, 0},
+    [OP_MULTIPLY_NUM]  = {-1, 0},
+    [OP_DIVIDE_NUM]    = {-1, 0},
+    [OP_NEGATE_NUM]    = { 0, 0},
+    [OP_GREATER_NUM]   = {-1, 0},
+    [OP_LESS_NUM]      = {-1, 0},
+};
+
+/*
+Everything one compile() needs, so several VMs can compile at once on different threads.
+Every parse function takes it as its first argument.
+*/
+struct Parser {
+    Token current;
+    Token previous;
+    bool hadError;
+    bool panicMode;
 
-Parser parser;
-Compiler* current = NULL;
-Chunk* compilingChunk;
+    VM* vm;            // owns the strings interned while compiling.
+    Scanner scanner;
+    TokenRing* ring;   // tokens come from the scanner thread instead of scanToken(); NULL if scanning inline.
+    Compiler* compiler;  // innermost function being compiled.
+    ClassCompiler* classCompiler; // innermost class being compiled; NULL outside classes.
+    int functions;       // functions started so far; numbers them for ObjFunction.ordinal.
+    long tokens;
+};
 
-static Chunk* currentChunk() {
-    return compilingChunk;
+static Chunk* currentChunk(Parser* parser) {
+    return &parser->compiler->function->chunk;
 }
 
-static void errorAt(Token* token, const char* message) {
-    if (parser.panicMode) return;
-    parser.panicMode = true; // Afer an error, go ahead and keep compliling as normal as if the error never occurred.
-    fprintf(stderr, "[line %d] Error", token->line);
+static void errorAt(Parser* parser, Token* token, const char* message) {
+    if (parser->panicMode) return;
+    parser->panicMode = true; // Afer an error, go ahead and keep compliling as normal as if the error never occurred.
+    fprintf(parser->vm->err, "[line %d] Error", token->line);
 
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(parser->vm->err, " at end");
     } else if (token->type == TOKEN_ERROR) {
         // Nothing.
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(parser->vm->err, " at '%.*s'", token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", message);
-    parser.hadError = true;
+    fprintf(parser->vm->err, ": %s\n", message);
+    parser->hadError = true;
 }
 
-static void error(const char* message) {
-    errorAt(&parser.previous, message);
+static void error(Parser* parser, const char* message) {
+    errorAt(parser, &parser->previous, message);
 }
 
-static void errorAtCurrent(const char* message) {
-    errorAt(&parser.current, message);
+static void errorAtCurrent(Parser* parser, const char* message) {
+    errorAt(parser, &parser->current, message);
 }
 
-static void advance() {
-    parser.previous = parser.current;
+static void advance(Parser* parser) {
+    parser->previous = parser->current;
 
     for (;;) {
-        parser.current = scanToken();  // scanner doesn’t report lexical errors. Instead, it creates special error tokens and leaves it up to the parser to report them.
-        if (parser.current.type != TOKEN_ERROR) break;
+        parser->current = parser->ring != NULL ? pipelineToken(parser->ring) : scanToken(&parser->scanner);
+        parser->tokens++;  // scanner doesn’t report lexical errors. Instead, it creates special error tokens and leaves it up to the parser to report them.
+        if (parser->current.type != TOKEN_ERROR) break;
 
-        errorAtCurrent(parser.current.start);
+        errorAtCurrent(parser, parser->current.start);
     }
 }
 
 // It's similar to advance() in that it reads the next token.
 // But it also validates that token has an expected type.
-static void consume(TokenType type, const char* message) {
-    if (parser.current.type == type) {
-        advance();
+static void consume(Parser* parser, TokenType type, const char* message) {
+    if (parser->current.type == type) {
+        advance(parser);
         return;
     }
 
-    errorAtCurrent(message);
+    errorAtCurrent(parser, message);
 }
 
-static bool check(TokenType type) {
-    return parser.current.type == type;
+static bool check(Parser* parser, TokenType type) {
+    return parser->current.type == type;
 }
 
-static bool match(TokenType type) {
-    if (!check(type)) return false;
-    advance();
+static bool match(Parser* parser, TokenType type) {
+    if (!check(parser, type)) return false;
+    advance(parser);
     return true;
 }
 
 // After we parse and understand a piece of the user’s program, the next step is 
 // to translate that to a series of bytecode instructions.
-static void emitByte(uint8_t byte) {
-    writeChunk(currentChunk(), byte, parser.previous.line);
+static void adjustStack(Parser* parser, int effect) {
+    parser->compiler->stackDepth += effect;
+    if (parser->compiler->stackDepth > currentChunk(parser)->maxStackDepth) {
+        currentChunk(parser)->maxStackDepth = parser->compiler->stackDepth;
+    }
 }
 
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
-    emitByte(byte1);
-    emitByte(byte2);
+static void emitByte(Parser* parser, uint8_t byte) {
+    writeChunk(currentChunk(parser), byte, parser->previous.line);
+
+    if (parser->compiler->operandBytes > 0) {
+        parser->compiler->operandBytes--; // an operand, not an instruction.
+        return;
+    }
+
+    adjustStack(parser, opInfo[byte].stackEffect);
+    parser->compiler->operandBytes = opInfo[byte].operandBytes;
+    if (byte == OP_JUMP || byte == OP_LOOP || byte == OP_RETURN) parser->compiler->reachable = false;
+}
+
+static void emitBytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
+    emitByte(parser, byte1);
+    emitByte(parser, byte2);
 }
 
-static int emitJump(uint8_t instruction) {
-    emitByte(instruction);  // emits a bytecode instruction and writes a placeholder operand for jump offset.
-    emitByte(0xff);  // use two bytes for the jump offset operand. A 16-bit offset jump over up to 65,535 bytes.
-    emitByte(0xff);
-    return currentChunk()->count - 2;
+static int emitJump(Parser* parser, uint8_t instruction) {
+    // the depth at the jump is the depth wherever it lands. Read it before the instruction's
+    // own effect so an unconditional jump doesn't lose it.
+    int depth = parser->compiler->stackDepth;
+    if (depth > UINT16_MAX) error(parser, "Expression too deeply nested.");
+
+    emitByte(parser, instruction);  // emits a bytecode instruction and writes a placeholder operand for jump offset.
+    // use two bytes for the jump offset operand. A 16-bit offset jump over up to 65,535 bytes.
+    // Until patchJump() overwrites it, the placeholder holds that stack depth.
+    emitByte(parser, (depth >> 8) & 0xff);
+    emitByte(parser, depth & 0xff);
+    return currentChunk(parser)->count - 2;
 }
 
-static void emitLoop(int loopStart) {
-    emitByte(OP_LOOP);
+static void emitLoop(Parser* parser, int loopStart) {
+    emitByte(parser, OP_LOOP);
 
-    int offset = currentChunk()->count - loopStart + 2;
+    int offset = currentChunk(parser)->count - loopStart + 2;
     if (offset > UINT16_MAX) {
-        error("Loop body too large.");
+        error(parser, "Loop body too large.");
     }
 
-    emitByte((offset >> 8) & 0xff);
-    emitByte(offset & 0xff);
+    emitByte(parser, (offset >> 8) & 0xff);
+    emitByte(parser, offset & 0xff);
 }
 
-static void emitReturn() {
-    /*
-     * When run clox, it will parse, compile, and execute a single expression, then print the result.
-     * To print that value, we are temporarily using the OP_RETURN instruction.
-     * */
-    emitByte(OP_RETURN);
+// falling off the end of a function returns nil; an initializer returns the new instance.
+static void emitReturn(Parser* parser) {
+    if (parser->compiler->type == TYPE_INITIALIZER) {
+        emitBytes(parser, OP_GET_LOCAL, 0);
+    } else {
+        emitByte(parser, OP_NIL);
+    }
+    emitByte(parser, OP_RETURN);
 }
 
-static uint8_t makeConstant(Value value) {
-    int constant = addConstant(currentChunk(), value);
+static uint8_t makeConstant(Parser* parser, Value value) {
+    // reuse an existing slot for the same value. Strings are interned, so names compare by pointer.
+    // Without this every mention of a global spends one of the 256 slots.
+    ValueArray* constants = &currentChunk(parser)->constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (valuesEqual(constants->values[i], value)) return (uint8_t)i;
+    }
+
+    int constant = addConstant(currentChunk(parser), value);
     if (constant > UINT8_MAX) {
-        error("Too many constants in one chunk.");
+        error(parser, "Too many constants in one chunk.");
         return 0;
     }
 
     return (uint8_t) constant;
 }
 
-static void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+static void emitConstant(Parser* parser, Value value) {
+    emitBytes(parser, OP_CONSTANT, makeConstant(parser, value));
 }
 
-static void patchJump(int offset) {
+static void patchJump(Parser* parser, int offset) {
     // goes back into the bytecode and replaces the operand at the given location.
     // param: offset -> how far to jump.
     // if condition is false, we need to jump over the code.
 
     // currentChunk()->count: number of bytecode in current chunk
-    int jump = currentChunk()->count - offset - 2;  // -2 to adjust for the bytecode for the jump offset itself.
+    int jump = currentChunk(parser)->count - offset - 2;  // -2 to adjust for the bytecode for the jump offset itself.
 
     if (jump > UINT16_MAX) {
-        error("Too much code to jump over.");
+        error(parser, "Too much code to jump over.");
+    }
+
+    // the code after an unconditional jump is only reached through this one,
+    // so it starts at the depth the placeholder recorded.
+    if (!parser->compiler->reachable) {
+        parser->compiler->stackDepth = (currentChunk(parser)->code[offset] << 8) | currentChunk(parser)->code[offset + 1];
+        parser->compiler->reachable = true;
     }
 
     // 바이트 코드에 jump 값(16비트)을 두 8비트에 기록
-    currentChunk()->code[offset] = (jump >> 8) & 0xff;
-    currentChunk()->code[offset + 1] = jump & 0xff;
+    currentChunk(parser)->code[offset] = (jump >> 8) & 0xff;
+    currentChunk(parser)->code[offset + 1] = jump & 0xff;
+}
+
+static ExprType typeOf(StaticType type) {
+    ExprType result;
+    memset(&result, 0, sizeof(result));
+    result.type = type;
+    return result;
+}
+
+static void addDeps(LocalSet* to, const LocalSet* from) {
+    for (int i = 0; i < UINT8_COUNT / 64; i++) to->bits[i] |= from->bits[i];
+}
+
+static bool hasDeps(const LocalSet* set) {
+    for (int i = 0; i < UINT8_COUNT / 64; i++) {
+        if (set->bits[i] != 0) return true;
+    }
+    return false;
+}
+
+static bool dependsOn(const LocalSet* set, int local) {
+    return (set->bits[local / 64] >> (local % 64)) & 1;
+}
+
+// a value that is either a or b at runtime, like the result of 'and' / 'or'.
+static ExprType joinTypes(ExprType a, ExprType b) {
+    if (a.type != b.type) return typeOf(TYPE_UNKNOWN);
+    addDeps(&a.deps, &b.deps);
+    return a;
+}
+
+// reading a local: a number only as long as the local stays one, and as long as every local
+// its value came from does. those are kept too, because they may outlive the local itself:
+// in '{ var y = x; print -y; }' y is gone by the time a later 'x = "s"' demotes x.
+static ExprType localType(Parser* parser, int index) {
+    ExprType type = parser->compiler->locals[index].type;
+    type.deps.bits[index / 64] |= (uint64_t)1 << (index % 64);
+    return type;
+}
+
+// emits the unchecked form of an instruction when its operands are proven numbers.
+static void emitChecked(Parser* parser, uint8_t checked, uint8_t unchecked, bool proven, LocalSet* deps) {
+    if (!proven) {
+        emitByte(parser, checked);
+        return;
+    }
+
+    emitByte(parser, unchecked);
+    if (!hasDeps(deps)) return; // proven by literals and arithmetic alone; that never changes.
+
+    if (parser->compiler->elidedCapacity < parser->compiler->elidedCount + 1) {
+        int oldCapacity = parser->compiler->elidedCapacity;
+        parser->compiler->elidedCapacity = GROW_CAPACITY(oldCapacity);
+        parser->compiler->elided = GROW_ARRAY(ElidedCheck, parser->compiler->elided, oldCapacity, parser->compiler->elidedCapacity);
+    }
+    ElidedCheck* check = &parser->compiler->elided[parser->compiler->elidedCount++];
+    check->offset = currentChunk(parser)->count - 1;
+    check->checked = checked;
+    check->deps = *deps;
 }
 
-static void initCompiler(Compiler* compiler) {
+// local 'index' was just found to hold a non-number: undo everything proven through it.
+// takes the compiler and not the parser: a closure capturing the local demotes it in an enclosing function.
+static void demoteLocal(Compiler* compiler, int index) {
+    for (int i = 0; i < compiler->elidedCount;) {
+        ElidedCheck* check = &compiler->elided[i];
+        if (dependsOn(&check->deps, index)) {
+            compiler->function->chunk.code[check->offset] = check->checked;
+            *check = compiler->elided[--compiler->elidedCount];
+        } else {
+            i++;
+        }
+    }
+
+    for (int i = 0; i < compiler->localCount; i++) {
+        Local* local = &compiler->locals[i];
+        if (local->type.type == TYPE_NUMBER && dependsOn(&local->type.deps, index)) {
+            local->type = typeOf(TYPE_UNKNOWN);
+            demoteLocal(compiler, i);
+        }
+    }
+}
+
+static void assignLocal(Parser* parser, int index, ExprType value) {
+    Local* local = &parser->compiler->locals[index];
+    if (local->type.type == value.type) {
+        addDeps(&local->type.deps, &value.deps);
+        return;
+    }
+
+    bool wasNumber = local->type.type == TYPE_NUMBER;
+    local->type = typeOf(TYPE_UNKNOWN);
+    if (wasNumber) demoteLocal(parser->compiler, index);
+}
+
+static void initCompiler(Parser* parser, Compiler* compiler, FunctionType type) {
+    compiler->enclosing = parser->compiler;
+    compiler->nesting = parser->compiler != NULL ? parser->compiler->nesting + 1 : 0;
+    compiler->type = type;
+    compiler->function = newFunction(parser->vm);
+    compiler->function->ordinal = parser->functions++;
+    if (type != TYPE_SCRIPT) {
+        // called right after the function's name was consumed.
+        compiler->function->name = copyString(parser->vm, parser->previous.start, parser->previous.length);
+    }
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
-    current = compiler;
+    compiler->stackDepth = 0;
+    compiler->operandBytes = 0;
+    compiler->reachable = true;
+    compiler->lastType = typeOf(TYPE_UNKNOWN);
+    compiler->leftType = typeOf(TYPE_UNKNOWN);
+    compiler->elided = NULL;
+    compiler->elidedCount = 0;
+    compiler->elidedCapacity = 0;
+    parser->compiler = compiler;
+
+    // slot 0 holds the function being called; it has no name, so user code can't refer to it.
+    // In a method it holds the receiver instead, and is named so 'this' resolves to it.
+    Local* local = &compiler->locals[compiler->localCount++];
+    local->depth = 0;
+    if (type == TYPE_METHOD || type == TYPE_INITIALIZER) {
+        local->name.start = "this";
+        local->name.length = 4;
+    } else {
+        local->name.start = "";
+        local->name.length = 0;
+    }
+    local->type = typeOf(TYPE_UNKNOWN);
+    local->isCaptured = false;
+    adjustStack(parser, 1);
 }
 
-static void endCompiler() {
-    emitReturn();
+static ObjFunction* endCompiler(Parser* parser) {
+    emitReturn(parser);
+    ObjFunction* function = parser->compiler->function;
+    FREE_ARRAY(ElidedCheck, parser->compiler->elided, parser->compiler->elidedCapacity);
 
 #ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) {
-        disassembleChunk(currentChunk(), "code");
+    if (!parser->hadError) {
+        disassembleChunk(currentChunk(parser), function->name != NULL ? function->name->chars : "<script>");
     }
 #endif
 
+    parser->compiler = parser->compiler->enclosing;
+    return function;
 }
 
-static void beginScope() {
-    current->scopeDepth++;
+static void beginScope(Parser* parser) {
+    parser->compiler->scopeDepth++;
 }
 
-static void endScope() {
-    current->scopeDepth--;
+static void endScope(Parser* parser) {
+    parser->compiler->scopeDepth--;
 
     // when a block ends, we need to put them to reset.
-    while (current -> localCount > 0 &&
-              current -> locals[current -> localCount - 1].depth > current -> scopeDepth) {
-          emitByte(OP_POP);
-          current -> localCount--;
+    while (parser->compiler->localCount > 0 &&
+              parser->compiler->locals[parser->compiler->localCount - 1].depth > parser->compiler->scopeDepth) {
+          // a captured local outlives its slot: the VM moves it to the heap before popping.
+          if (parser->compiler->locals[parser->compiler->localCount - 1].isCaptured) {
+              emitByte(parser, OP_CLOSE_UPVALUE);
+          } else {
+              emitByte(parser, OP_POP);
+          }
+          parser->compiler->localCount--;
      }
 }
 
 // forward declaration
-static void expression();
-static void statement();
-static void declaration();
+static void expression(Parser* parser);
+static void statement(Parser* parser);
+static void declaration(Parser* parser);
 static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Parser* parser, Precedence precedence);
+static void namedVariable(Parser* parser, Token name, bool canAssign);
+static void variable(Parser* parser, bool canAssign);
 
-static void parsePrecedence(Precedence precedence) {
-    advance();
+static void parsePrecedence(Parser* parser, Precedence precedence) {
+    advance(parser);
     /* look up a prefix parser for the current token.
     The first token is always going to belong tot some kind of prefix expression.
     It may turn out to be nested as an operand inside one or more infix expressions,
@@ -240,9 +567,9 @@ static void parsePrecedence(Precedence precedence) {
 
     ex) -a.b + c;
     */
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+    ParseFn prefixRule = getRule(parser->previous.type)->prefix;
     if (prefixRule == NULL) {
-        error("Expect expression.");
+        error(parser, "Expect expression.");
         return;
     }
 
@@ -253,35 +580,46 @@ static void parsePrecedence(Precedence precedence) {
         불가능한 경우: ex) a + b = c; precedence 값이 높기에 +, *, . 등은 허용되지 않음 
     */
     bool canAssign = precedence <= PREC_ASSIGNMENT;
-    prefixRule(canAssign);
+    parser->compiler->lastType = typeOf(TYPE_UNKNOWN); // rules that don't know their type leave it unknown.
+    prefixRule(parser, canAssign);
 
     /*
     17.6.1 Parsing with precedence
     If the next token is too low precedence, or isn't an infix operator at all, then we're done.
     Otherwise, we parse the infix operator and its right operand.
-    It consumes whatever other tokens it needs(usually the right operand) and returns back to parsePrecedence().
+    It consumes whatever other tokens it needs(usually the right operand) and returns back to parsePrecedence(parser).
     Then we loop back around and see if the next token is also a valid infix operator that can take the entire
     preceding expression as its operand.
     Keep looping like that, crunching through infix operators and their operands until we hit a token that
      isn't an infix operator or is too low precedence and stop.
     */
-    while (precedence <= getRule(parser.current.type) -> precedence) {
-        advance();
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule(canAssign);
+    while (precedence <= getRule(parser->current.type) -> precedence) {
+        advance(parser);
+        ParseFn infixRule = getRule(parser->previous.type)->infix;
+        parser->compiler->leftType = parser->compiler->lastType;
+        parser->compiler->lastType = typeOf(TYPE_UNKNOWN);
+        infixRule(parser, canAssign);
     }
 
     // If the = doesn't get consumed as part of the expression, nothing else is going to consume it.
-    if (canAssign && match(TOKEN_EQUAL)) {
-        error("Invalid assignment target.");
-        expression();
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        error(parser, "Invalid assignment target.");
+        expression(parser);
     }
 }
 
 // takes the given token and adds its lexeme to the chunk's constant table as a string.
 // then, returns the index of that constant in the constant table.
-static uint8_t identifierConstant(Token* name) {
-    return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+static uint8_t identifierConstant(Parser* parser, Token* name) {
+    return makeConstant(parser, OBJ_VAL(copyString(parser->vm, name->start, name->length)));
+}
+
+// a token for a name the compiler refers to that isn't in the source, like 'this' and 'super'.
+static Token syntheticToken(const char* text) {
+    Token token;
+    token.start = text;
+    token.length = (int)strlen(text);
+    return token;
 }
 
 static bool identifiersEqual(Token* a, Token* b) {
@@ -291,13 +629,13 @@ static bool identifiersEqual(Token* a, Token* b) {
 
 // walk the list of locals that are currently in scope.
 // walk the array backward so that we find the last declared variable.
-static int resolveLocal(Compiler* compiler, Token* name) {
+static int resolveLocal(Parser* parser, Compiler* compiler, Token* name) {
     for (int i = compiler->localCount -1; i >= 0; i--) {
         Local* local = &compiler->locals[i];
         if (identifiersEqual(name, &local->name)) {
             if (local->depth == -1) {
                 // "Declaring" 후 "Defining" 되지 않은 경우.
-                error("Cannot read local variable in its own initializer.");
+                error(parser, "Cannot read local variable in its own initializer.");
             }
             return i;
         }
@@ -306,15 +644,72 @@ static int resolveLocal(Compiler* compiler, Token* name) {
     return -1;
 }
 
+static int addUpvalue(Parser* parser, Compiler* compiler, uint8_t index, bool isLocal) {
+    int upvalueCount = compiler->function->upvalueCount;
+
+    // a closure referring to the same variable twice captures it once.
+    for (int i = 0; i < upvalueCount; i++) {
+        Upvalue* upvalue = &compiler->upvalues[i];
+        if (upvalue->index == index && upvalue->isLocal == isLocal) return i;
+    }
+
+    if (upvalueCount == UINT8_COUNT) {
+        error(parser, "Too many closure variables in function.");
+        return 0;
+    }
+
+    compiler->upvalues[upvalueCount].isLocal = isLocal;
+    compiler->upvalues[upvalueCount].index = index;
+    return compiler->function->upvalueCount++;
+}
+
+/*
+A captured local can be assigned by the closure at any time, through OP_SET_UPVALUE, and the
+static types never see those writes. So it stops being a proven number for good, and whatever
+was already proven through it goes back to the checked opcodes.
+*/
+static void captureLocal(Compiler* compiler, int index) {
+    Local* local = &compiler->locals[index];
+    local->isCaptured = true;
+
+    bool wasNumber = local->type.type == TYPE_NUMBER;
+    local->type = typeOf(TYPE_UNKNOWN);
+    if (wasNumber) demoteLocal(compiler, index);
+}
+
+/*
+Looks the name up in the enclosing functions, innermost first. A local found there is captured
+directly; one further out is captured by each function in between and passed down as an upvalue,
+so at runtime every closure only ever looks one level up.
+*/
+static int resolveUpvalue(Parser* parser, Compiler* compiler, Token* name) {
+    if (compiler->enclosing == NULL) return -1;
+
+    int local = resolveLocal(parser, compiler->enclosing, name);
+    if (local != -1) {
+        captureLocal(compiler->enclosing, local);
+        return addUpvalue(parser, compiler, (uint8_t)local, true);
+    }
+
+    int upvalue = resolveUpvalue(parser, compiler->enclosing, name);
+    if (upvalue != -1) {
+        return addUpvalue(parser, compiler, (uint8_t)upvalue, false);
+    }
+
+    return -1;
+}
+
 // stores the variable's name and the depth of the scope that owns the variable.
-static void addLocal(Token name) {
-    if (current->localCount == UINT8_COUNT) {
-        error("Too many local variables in function.");
+static void addLocal(Parser* parser, Token name) {
+    if (parser->compiler->localCount == UINT8_COUNT) {
+        error(parser, "Too many local variables in function.");
         return;
     }
 
-    Local* local = &current->locals[current->localCount++];
+    Local* local = &parser->compiler->locals[parser->compiler->localCount++];
     local->name = name;
+    local->type = typeOf(TYPE_UNKNOWN);
+    local->isCaptured = false;
     /*
     after we finish compiling the initializer, mark the variable as initialized and ready to use.
     before we finish, set special sentienl value, -1
@@ -326,7 +721,7 @@ static void addLocal(Token name) {
     1) declare uninitialized
     2) ready for use
     */
-    // local->depth = current->scopeDepth;
+    // local->depth = parser->compiler->scopeDepth;
     local->depth = -1;
 }
 
@@ -336,59 +731,56 @@ static void addLocal(Token name) {
 컴파일 시점에 컴파일러가 전역 변수의 선언을 모두 알고 있을 필요가 없음.
 따라서 컴파일러는 전역 변수의 선언을 따로 추적하거나 관리하지 않고, 나중에 프로그램이 실행될 때 전역 변수를 찾음.
 */
-static void declareVariable() {
-    if (current->scopeDepth == 0) return;
+static void declareVariable(Parser* parser) {
+    if (parser->compiler->scopeDepth == 0) return;
 
-    Token* name = &parser.previous;
+    Token* name = &parser->previous;
 
     // error to have two variables with the same name in the same local scope.
-    for (int i = current -> localCount - 1; i >= 0; i--) {
-        Local* local = &current->locals[i];
+    for (int i = parser->compiler->localCount - 1; i >= 0; i--) {
+        Local* local = &parser->compiler->locals[i];
         // local variable are appended to the array when they're declared,
         // which means the current scope is always at the end of the array.
         // 어차피 end of the array 비교인데 for loop을 사용해야하나?
-        if (local->depth != -1 && local->depth < current->scopeDepth) {
+        if (local->depth != -1 && local->depth < parser->compiler->scopeDepth) {
             break;
         }
 
         if (identifiersEqual(name, &local->name)) {
-            error("Already a variable with this name in this scope.");
+            error(parser, "Already a variable with this name in this scope.");
         }
     }
 
-    addLocal(*name);
+    addLocal(parser, *name);
 }
 
-static void defineVariable(uint8_t global) {
+static void markInitialized(Parser* parser) {
+    if (parser->compiler->scopeDepth == 0) return; // a global function; OP_DEFINE_GLOBAL defines it.
+    parser->compiler->locals[parser->compiler->localCount -1].depth = parser->compiler->scopeDepth;
+}
+
+static void defineVariable(Parser* parser, uint8_t global) {
     /* 
     No code to create a local variable at runtime.
     VM has already executed the code for variable's initializer, 
     and that value is sitting right on top of the stack as the only remaining temporary.
     */
-    if (current -> scopeDepth > 0) {
+    if (parser->compiler->scopeDepth > 0) {
         // "Declaring" is when the variable is added to the scope, and "Defining" is when it becomes available for use.
-        markInitialized();
+        markInitialized(parser);
         return;
     }
 
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitBytes(parser, OP_DEFINE_GLOBAL, global);
 }
 
-static uint8_t parseVariable(const char* errorMessage) {
-    consume(TOKEN_IDENTIFIER, errorMessage);
-
-    declareVariable();
-    if (current->scopeDepth > 0) return 0; // At runtime, locals aren't looked up by name.
-
-    return identifierConstant(&parser.previous);
-}
+static uint8_t parseVariable(Parser* parser, const char* errorMessage) {
+    consume(parser, TOKEN_IDENTIFIER, errorMessage);
 
-static void markInitialized() {
-    current->locals[current->localCount -1].depth = current->scopeDepth;
-}   
+    declareVariable(parser);
+    if (parser->compiler->scopeDepth > 0) return 0; // At runtime, locals aren't looked up by name.
 
-static void defineVariable(uint8_t global) {
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    return identifierConstant(parser, &parser->previous);
 }
 
 /*
@@ -397,15 +789,123 @@ static void defineVariable(uint8_t global) {
         - OP_POP
     - right operand expression
 */
-static void and_(bool canAssign) {
-    int endJump = emitJump(OP_JUMP_IF_FALSE);
+static void and_(Parser* parser, bool canAssign) {
+    ExprType left = parser->compiler->leftType;
+    int endJump = emitJump(parser, OP_JUMP_IF_FALSE);
 
-    emitByte(OP_POP);
-    parsePrecedence(PREC_AND); // 오른쪽 연산자 평가
+    emitByte(parser, OP_POP);
+    parsePrecedence(parser, PREC_AND); // 오른쪽 연산자 평가
     
     // 조건부 점프 명령어의 목적지를 수정하여, 점프할 위치를 바이트코드에서 정확하게 설정. 
     // 조건이 거짓일 경우 점프할 위치를 지정하여 바이트코드의 흐름을 제어
-    patchJump(endJump);  
+    patchJump(parser, endJump);  
+    parser->compiler->lastType = joinTypes(left, parser->compiler->lastType);
+}
+
+// types: the join of the arguments' types, so TYPE_NUMBER only if every one is a number.
+static uint8_t argumentList(Parser* parser, ExprType* types) {
+    uint8_t argCount = 0;
+    *types = typeOf(TYPE_NUMBER);
+    if (!check(parser, TOKEN_RIGHT_PAREN)) {
+        do {
+            expression(parser);
+            *types = joinTypes(*types, parser->compiler->lastType);
+            if (argCount == 255) {
+                error(parser, "Can't have more than 255 arguments.");
+            }
+            argCount++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return argCount;
+}
+
+/*
+The callee is already on the stack, and the arguments are pushed right above it,
+which is exactly where the callee's frame expects its parameters.
+*/
+static void call(Parser* parser, bool canAssign) {
+    ExprType types;
+    uint8_t argCount = argumentList(parser, &types);
+    // a typed native takes one or two numbers; proving them lets the VM call it without checks.
+    bool numbers = types.type == TYPE_NUMBER && (argCount == 1 || argCount == 2);
+    emitChecked(parser, OP_CALL, OP_CALL_NUM, numbers, &types.deps);
+    emitByte(parser, argCount);
+    adjustStack(parser, -argCount); // the arguments become the callee's slots; only the result is left.
+    parser->compiler->lastType = typeOf(TYPE_UNKNOWN); // not the type of the last argument.
+}
+
+// every property access gets its own inline cache in the chunk; the operand is its index.
+static void emitProperty(Parser* parser, uint8_t instruction, uint8_t name) {
+    int cache = addPropertyCache(currentChunk(parser));
+    if (cache > UINT16_MAX) {
+        error(parser, "Too many property accesses in one function.");
+    }
+    emitBytes(parser, instruction, name);
+    emitBytes(parser, (cache >> 8) & 0xff, cache & 0xff);
+}
+
+// every method call site gets its own method cache, as property accesses get theirs.
+static void emitInvoke(Parser* parser, uint8_t instruction, uint8_t name, uint8_t argCount) {
+    int cache = addMethodCache(currentChunk(parser));
+    if (cache > UINT16_MAX) {
+        error(parser, "Too many method calls in one function.");
+    }
+    emitBytes(parser, instruction, name);
+    emitBytes(parser, argCount, (cache >> 8) & 0xff);
+    emitByte(parser, cache & 0xff);
+    adjustStack(parser, -argCount);
+    parser->compiler->lastType = typeOf(TYPE_UNKNOWN);
+}
+
+static void dot(Parser* parser, bool canAssign) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect property name after '.'.");
+    uint8_t name = identifierConstant(parser, &parser->previous);
+
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emitProperty(parser, OP_SET_PROPERTY, name);
+        // the assignment's value is the assigned value, so lastType stays as it is.
+    } else if (match(parser, TOKEN_LEFT_PAREN)) {
+        // a.name(args) is one OP_INVOKE instead of OP_GET_PROPERTY making a bound method and OP_CALL calling it.
+        ExprType types;
+        uint8_t argCount = argumentList(parser, &types);
+        emitInvoke(parser, OP_INVOKE, name, argCount);
+    } else {
+        emitProperty(parser, OP_GET_PROPERTY, name);
+    }
+}
+
+// [a, b, c]: the elements are pushed in order and one instruction collects them.
+static void arrayLiteral(Parser* parser, bool canAssign) {
+    int count = 0;
+    if (!check(parser, TOKEN_RIGHT_BRACKET)) {
+        do {
+            expression(parser);
+            if (count == UINT8_MAX) {
+                error(parser, "Can't have more than 255 elements in an array literal.");
+            }
+            count++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after array elements.");
+    emitBytes(parser, OP_BUILD_ARRAY, (uint8_t)count);
+    adjustStack(parser, -count);
+    parser->compiler->lastType = typeOf(TYPE_UNKNOWN);
+}
+
+static void index_(Parser* parser, bool canAssign) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emitByte(parser, OP_SET_INDEX);
+        // the assignment's value is the assigned value, so lastType stays as it is.
+    } else {
+        emitByte(parser, OP_GET_INDEX);
+        parser->compiler->lastType = typeOf(TYPE_UNKNOWN);
+    }
 }
 
 /*
@@ -419,93 +919,427 @@ leaving their values on the stack. Then it executes the instruction for the
 operator. That pops the two values, computes the operation, and pushes the
 result.
 */
-static void binary(bool canAssign) {
-    TokenType operatorType = parser.previous.type;
+static void binary(Parser* parser, bool canAssign) {
+    ExprType left = parser->compiler->leftType;
+    TokenType operatorType = parser->previous.type;
     ParseRule* rule = getRule(operatorType);
-    parsePrecedence((Precedence)(rule->precedence + 1));
+    parsePrecedence(parser, (Precedence)(rule->precedence + 1));
+    ExprType right = parser->compiler->lastType;
+
+    // with both operands proven numbers, the unchecked opcodes skip the IS_NUMBER tests.
+    bool numbers = left.type == TYPE_NUMBER && right.type == TYPE_NUMBER;
+    LocalSet deps = left.deps;
+    addDeps(&deps, &right.deps);
 
     switch (operatorType) {
-        case TOKEN_BANG_EQUAL: emitBytes(OP_EQUAL, OP_NOT); break;
-        case TOKEN_EQUAL_EQUAL: emitByte(OP_EQUAL); break;
-        case TOKEN_GREATER: emitByte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT); break;
-        case TOKEN_LESS: emitByte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL: emitBytes(OP_GREATER, OP_NOT); break;
-        case TOKEN_PLUS: emitByte(OP_ADD); break;
-        case TOKEN_MINUS: emitByte(OP_SUBTRACT); break;
-        case TOKEN_STAR: emitByte(OP_MULTIPLY); break;
-        case TOKEN_SLASH: emitByte(OP_DIVIDE); break;
+        case TOKEN_BANG_EQUAL: emitBytes(parser, OP_EQUAL, OP_NOT); break;
+        case TOKEN_EQUAL_EQUAL: emitByte(parser, OP_EQUAL); break;
+        case TOKEN_GREATER: emitChecked(parser, OP_GREATER, OP_GREATER_NUM, numbers, &deps); break;
+        case TOKEN_GREATER_EQUAL:
+            emitChecked(parser, OP_LESS, OP_LESS_NUM, numbers, &deps);
+            emitByte(parser, OP_NOT);
+            break;
+        case TOKEN_LESS: emitChecked(parser, OP_LESS, OP_LESS_NUM, numbers, &deps); break;
+        case TOKEN_LESS_EQUAL:
+            emitChecked(parser, OP_GREATER, OP_GREATER_NUM, numbers, &deps);
+            emitByte(parser, OP_NOT);
+            break;
+        case TOKEN_PLUS: emitChecked(parser, OP_ADD, OP_ADD_NUM, numbers, &deps); break;
+        case TOKEN_MINUS: emitChecked(parser, OP_SUBTRACT, OP_SUBTRACT_NUM, numbers, &deps); break;
+        case TOKEN_STAR: emitChecked(parser, OP_MULTIPLY, OP_MULTIPLY_NUM, numbers, &deps); break;
+        case TOKEN_SLASH: emitChecked(parser, OP_DIVIDE, OP_DIVIDE_NUM, numbers, &deps); break;
         default: return; // Unreachable.
     }
+
+    switch (operatorType) {
+        case TOKEN_PLUS:
+            // a number only if both sides are; the result is as certain as they are.
+            if (numbers) {
+                parser->compiler->lastType = typeOf(TYPE_NUMBER);
+                parser->compiler->lastType.deps = deps;
+            } else if (left.type == TYPE_STRING && right.type == TYPE_STRING) {
+                parser->compiler->lastType = typeOf(TYPE_STRING);
+            }
+            break;
+        case TOKEN_MINUS:
+        case TOKEN_STAR:
+        case TOKEN_SLASH:
+            // the checked forms fail on anything else, so the result is always a number.
+            parser->compiler->lastType = typeOf(TYPE_NUMBER);
+            break;
+        default:
+            parser->compiler->lastType = typeOf(TYPE_BOOL);
+            break;
+    }
 }
 
-static void literal(bool canAssign) {
-    switch (parser.previous.type) {
-        case TOKEN_FALSE: emitByte(OP_FALSE); break;
-        case TOKEN_NIL: emitByte(OP_NIL); break;
-        case TOKEN_TRUE: emitByte(OP_TRUE); break;
+static void literal(Parser* parser, bool canAssign) {
+    switch (parser->previous.type) {
+        case TOKEN_FALSE: emitByte(parser, OP_FALSE); break;
+        case TOKEN_NIL: emitByte(parser, OP_NIL); break;
+        case TOKEN_TRUE: emitByte(parser, OP_TRUE); break;
         default: return; // Unreachable.
     }
+    parser->compiler->lastType = typeOf(parser->previous.type == TOKEN_NIL ? TYPE_NIL : TYPE_BOOL);
 }
 
-static void expression() {
-    parsePrecedence(PREC_ASSIGNMENT);
+static void expression(Parser* parser) {
+    parsePrecedence(parser, PREC_ASSIGNMENT);
 }
 
-static void block() {
-    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-        declaration();
+static void block(Parser* parser) {
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        declaration(parser);
     }
 
-    consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void varDeclaration() {
-    uint8_t global = parseVariable("Expect variable name.");
+static void varDeclaration(Parser* parser) {
+    uint8_t global = parseVariable(parser, "Expect variable name.");
 
     /* 
     IF the user doesn't initialize the variable,
     the compiler implicitly initializes it to nil by emitting an OP_NIL instruction.
     ex) var a;
     */
-    if (match(TOKEN_EQUAL)) {
-        expression();
+    if (match(parser, TOKEN_EQUAL)) {
+        expression(parser);
     } else {
-        emitByte(OP_NIL);
+        emitByte(parser, OP_NIL);
+        parser->compiler->lastType = typeOf(TYPE_NIL);
+    }
+
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+
+    if (parser->compiler->scopeDepth > 0) {
+        parser->compiler->locals[parser->compiler->localCount - 1].type = parser->compiler->lastType;
+    }
+
+    defineVariable(parser, global);
+}
+
+/*
+Skips a function that is nested too deeply to compile: up to its body's closing '}'.
+Interpolated strings end their expressions in string tokens, so the braces counted here pair up.
+That leaves the parser where the function ends, back in step, so it leaves panic mode too:
+synchronize() would otherwise skip the enclosing blocks' '}'s as well.
+*/
+static void skipFunction(Parser* parser) {
+    int braces = 0;
+    while (parser->current.type != TOKEN_EOF) {
+        if (parser->current.type == TOKEN_LEFT_BRACE) {
+            braces++;
+        } else if (parser->current.type == TOKEN_RIGHT_BRACE && --braces == 0) {
+            advance(parser);
+            break;
+        }
+        advance(parser);
+    }
+    parser->panicMode = false;
+}
+
+/*
+Compiles the parameters and body into a new function, then leaves that function
+in the enclosing chunk's constant table.
+*/
+static void function(Parser* parser, FunctionType type) {
+    // each level is a Compiler on the C stack, a few dozen KB, plus the calls that parse its body.
+    if (parser->compiler->nesting == FUNCTION_NESTING_MAX) {
+        error(parser, "Too much nesting.");
+        skipFunction(parser);
+        emitByte(parser, OP_NIL); // stands in for the function, so the caller's bookkeeping still adds up.
+        return;
     }
 
-    consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+    Compiler compiler;
+    initCompiler(parser, &compiler, type);
+    beginScope(parser); // never ended: OP_RETURN drops the whole frame at once.
+
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(parser, TOKEN_RIGHT_PAREN)) {
+        do {
+            parser->compiler->function->arity++;
+            if (parser->compiler->function->arity > 255) {
+                errorAtCurrent(parser, "Can't have more than 255 parameters.");
+            }
+            uint8_t constant = parseVariable(parser, "Expect parameter name.");
+            defineVariable(parser, constant);
+            adjustStack(parser, 1); // the caller already pushed the argument into this slot.
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block(parser);
+
+    ObjFunction* function = endCompiler(parser);
+    if (function->upvalueCount == 0) {
+        // nothing captured: the function itself is the value, and creating it costs nothing at runtime.
+        emitConstant(parser, OBJ_VAL(function));
+        return;
+    }
+
+    emitBytes(parser, OP_CLOSURE, makeConstant(parser, OBJ_VAL(function)));
+    parser->compiler->operandBytes = function->upvalueCount * 2; // not opcodes, for the stack bookkeeping.
+    for (int i = 0; i < function->upvalueCount; i++) {
+        emitByte(parser, compiler.upvalues[i].isLocal ? 1 : 0);
+        emitByte(parser, compiler.upvalues[i].index);
+    }
+}
+
+static void method(Parser* parser) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect method name.");
+    uint8_t constant = identifierConstant(parser, &parser->previous);
+
+    FunctionType type = TYPE_METHOD;
+    if (parser->previous.length == 4 && memcmp(parser->previous.start, "init", 4) == 0) {
+        type = TYPE_INITIALIZER;
+    }
+    function(parser, type);
+    emitBytes(parser, OP_METHOD, constant);
+}
+
+/*
+    - OP_CLASS: creates the class and binds its name
+    - for each method: the method's function, then OP_METHOD adds it to the class
+      (the class is loaded back onto the stack for this, and popped at the end)
+*/
+static void classDeclaration(Parser* parser) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect class name.");
+    Token className = parser->previous;
+    uint8_t nameConstant = identifierConstant(parser, &parser->previous);
+    declareVariable(parser);
+
+    emitBytes(parser, OP_CLASS, nameConstant);
+    defineVariable(parser, nameConstant);
+
+    ClassCompiler classCompiler;
+    classCompiler.enclosing = parser->classCompiler;
+    classCompiler.hasSuperclass = false;
+    parser->classCompiler = &classCompiler;
+
+    // the superclass is kept in a local named 'super', in a scope around the methods, which capture it.
+    if (match(parser, TOKEN_LESS)) {
+        consume(parser, TOKEN_IDENTIFIER, "Expect superclass name.");
+        variable(parser, false);
+        if (identifiersEqual(&className, &parser->previous)) {
+            error(parser, "A class can't inherit from itself.");
+        }
+
+        beginScope(parser);
+        addLocal(parser, syntheticToken("super"));
+        markInitialized(parser);
 
-    defineVariable(global);
+        namedVariable(parser, className, false);
+        emitByte(parser, OP_INHERIT);
+        classCompiler.hasSuperclass = true;
+    }
+
+    namedVariable(parser, className, false);
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before class body.");
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        method(parser);
+    }
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
+    emitByte(parser, OP_POP);
+
+    if (classCompiler.hasSuperclass) endScope(parser);
+
+    parser->classCompiler = parser->classCompiler->enclosing;
+}
+
+static void funDeclaration(Parser* parser) {
+    uint8_t global = parseVariable(parser, "Expect function name.");
+    markInitialized(parser); // the body may refer to the function itself, for recursion.
+    function(parser, TYPE_FUNCTION);
+    defineVariable(parser, global);
+}
+
+static void expressionStatement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
+    emitByte(parser, OP_POP);
 }
 
-static void expressionStatement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-    emitByte(OP_POP);
+static double parseNumber(const Token* token) {
+    /*
+     * strtod: 문자 스트링을 double, float 또는 long double 값으로 변환.
+     * The lexeme isn't NUL-terminated (the source can be a mapped file),
+     * so strtod() gets a terminated copy instead of reading past the token.
+     * */
+    char buffer[64];
+    int length = token->length;
+    char* lexeme = length < (int)sizeof(buffer) ? buffer : malloc(length + 1);
+    memcpy(lexeme, token->start, length);
+    lexeme[length] = '\0';
+
+    double value = strtod(lexeme, NULL);
+    if (lexeme != buffer) free(lexeme);
+    return value;
+}
+
+// a case label: a number (maybe negated), string, true, false or nil literal.
+static Value caseLabel(Parser* parser) {
+    if (match(parser, TOKEN_MINUS)) {
+        consume(parser, TOKEN_NUMBER, "Expect number after '-' in case label.");
+        return NUMBER_VAL(-parseNumber(&parser->previous));
+    }
+    if (match(parser, TOKEN_NUMBER)) return NUMBER_VAL(parseNumber(&parser->previous));
+    if (match(parser, TOKEN_STRING)) {
+        return OBJ_VAL(copyString(parser->vm, parser->previous.start + 1, parser->previous.length - 2));
+    }
+    if (match(parser, TOKEN_TRUE)) return BOOL_VAL(true);
+    if (match(parser, TOKEN_FALSE)) return BOOL_VAL(false);
+    if (match(parser, TOKEN_NIL)) return NIL_VAL;
+
+    errorAtCurrent(parser, "Case label must be a number, string, true, false or nil literal.");
+    return NIL_VAL;
 }
 
-static void forStatement() {
-    beginScope();
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for').");
-    if (match(TOKEN_SEMICOLON)) {
+/*
+Whole-number labels that cover at least half of the range from the lowest to the highest
+get an OP_TABLE_SWITCH; the table is then at most twice as long as the list of labels.
+*/
+static bool denseLabels(ValueTable* labels, int* low, int* count) {
+    double min = 0, max = 0;
+    for (int i = 0; i < labels->entryCount; i++) {
+        Value label = labels->entries[i].key;
+        if (!IS_NUMBER(label)) return false;
+        double number = AS_NUMBER(label);
+        if (number < INT32_MIN || number > INT32_MAX || number != (int32_t)number) return false;
+        if (i == 0 || number < min) min = number;
+        if (i == 0 || number > max) max = number;
+    }
+
+    double range = max - min + 1;
+    if (labels->entryCount == 0 || range > 2.0 * labels->entryCount) return false;
+    *low = (int)min;
+    *count = (int)range;
+    return true;
+}
+
+/*
+switch (value) { case 1, 2: ... case "a": ... default: ... }
+Labels are literals and a value runs the statements of the one case it matches, or of
+default; cases don't fall through. The value is popped by one OP_LOOKUP_SWITCH, which
+jumps straight to the case, instead of a chain of OP_EQUAL and OP_JUMP_IF_FALSE per label.
+It becomes an OP_TABLE_SWITCH once all the labels are known and turn out to be dense.
+
+    (1) OP_LOOKUP_SWITCH / OP_TABLE_SWITCH -> 해당 case 로 이동
+    - case body statements
+        (2) OP_JUMP -> (3) 으로 이동
+    - ... 다른 case 들
+    (3) continue..
+*/
+static void switchStatement(Parser* parser) {
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'switch'.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after switch value.");
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before switch cases.");
+
+    // the chunk's switch array may grow while the cases compile, so keep the index, not a pointer.
+    int table = addSwitchTable(currentChunk(parser));
+    if (table > UINT16_MAX) {
+        error(parser, "Too many switch statements in one function.");
+    }
+    emitByte(parser, OP_LOOKUP_SWITCH);
+    int switchOffset = currentChunk(parser)->count - 1;
+    emitBytes(parser, (table >> 8) & 0xff, table & 0xff);
+    int casesStart = currentChunk(parser)->count;
+    int depth = parser->compiler->stackDepth;
+
+    int* endJumps = NULL;
+    int endJumpCount = 0;
+    int endJumpCapacity = 0;
+    bool hasDefault = false;
+
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        int target = currentChunk(parser)->count - casesStart;
+        if (match(parser, TOKEN_CASE)) {
+            do {
+                Value label = caseLabel(parser);
+                ValueTable* labels = &currentChunk(parser)->switches[table].labels;
+                if (!isHashableKey(label)) continue; // only an error above gets here.
+                if (!valueTableSet(labels, label, NUMBER_VAL(target))) {
+                    error(parser, "Duplicate case label.");
+                }
+            } while (match(parser, TOKEN_COMMA));
+            consume(parser, TOKEN_COLON, "Expect ':' after case label.");
+        } else if (match(parser, TOKEN_DEFAULT)) {
+            if (hasDefault) error(parser, "A switch can only have one default case.");
+            hasDefault = true;
+            currentChunk(parser)->switches[table].defaultTarget = target;
+            consume(parser, TOKEN_COLON, "Expect ':' after 'default'.");
+        } else {
+            // compile the stray statements as if they were a case, so the braces still match up.
+            errorAtCurrent(parser, "Expect 'case' or 'default'.");
+        }
+
+        // every case is entered from the switch instruction, at the depth it left.
+        parser->compiler->stackDepth = depth;
+        parser->compiler->reachable = true;
+
+        // each case is its own scope, so a variable declared in one isn't visible in the next.
+        beginScope(parser);
+        while (!check(parser, TOKEN_CASE) && !check(parser, TOKEN_DEFAULT) &&
+               !check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+            declaration(parser);
+        }
+        endScope(parser);
+
+        if (endJumpCapacity < endJumpCount + 1) {
+            int oldCapacity = endJumpCapacity;
+            endJumpCapacity = GROW_CAPACITY(oldCapacity);
+            endJumps = GROW_ARRAY(int, endJumps, oldCapacity, endJumpCapacity);
+        }
+        endJumps[endJumpCount++] = emitJump(parser, OP_JUMP);
+    }
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after switch cases.");
+
+    for (int i = 0; i < endJumpCount; i++) patchJump(parser, endJumps[i]);
+    FREE_ARRAY(int, endJumps, endJumpCapacity);
+    parser->compiler->stackDepth = depth;
+    parser->compiler->reachable = true;
+
+    SwitchTable* switchTable = &currentChunk(parser)->switches[table];
+    if (!hasDefault) switchTable->defaultTarget = currentChunk(parser)->count - casesStart;
+
+    int low, count;
+    if (denseLabels(&switchTable->labels, &low, &count)) {
+        switchTable->low = low;
+        switchTable->count = count;
+        switchTable->targets = ALLOCATE(int, count);
+        for (int i = 0; i < count; i++) switchTable->targets[i] = switchTable->defaultTarget;
+        for (int i = 0; i < switchTable->labels.entryCount; i++) {
+            MapEntry* entry = &switchTable->labels.entries[i];
+            switchTable->targets[(int)AS_NUMBER(entry->key) - low] = (int)AS_NUMBER(entry->value);
+        }
+        // same operands and stack effect, so only the opcode changes.
+        currentChunk(parser)->code[switchOffset] = OP_TABLE_SWITCH;
+    }
+}
+
+static void forStatement(Parser* parser) {
+    beginScope(parser);
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for').");
+    if (match(parser, TOKEN_SEMICOLON)) {
         // No initializer.
-    } else if (match(TOKEN_VAR)) {
-        varDeclaration();
+    } else if (match(parser, TOKEN_VAR)) {
+        varDeclaration(parser);
     } else {
-        expressionStatement();
+        expressionStatement(parser);
     }
 
-    int loopStart = currentChunk()->count;
+    int loopStart = currentChunk(parser)->count;
     
     int exitJump = -1;
-    if (!match(TOKEN_SEMICOLON)) { // clause is optional, we need to see if it's actually present.
-        expression();
-        consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+    if (!match(parser, TOKEN_SEMICOLON)) { // clause is optional, we need to see if it's actually present.
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
         // Jump out of the loop if the condition is false.
-        exitJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP); // pop condition value
+        exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+        emitByte(parser, OP_POP); // pop condition value
     }
 
     /*
@@ -513,32 +1347,30 @@ static void forStatement() {
     Optional clause.
 
     */
-    if (!match(TOKEN_RIGHT_PAREN)) {
-        int bodyJump = emitJump(OP_JUMP);
-        int incrementStart = currentChunk()->count;
-        expression();
-        emitByte(OP_POP);
-        consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
-
-        emitLoop(loopStart); // go back to main top loop. happens agian right after the increment clause. since the increment executes at the end of each loop iteration.
+    if (!match(parser, TOKEN_RIGHT_PAREN)) {
+        int bodyJump = emitJump(parser, OP_JUMP);
+        int incrementStart = currentChunk(parser)->count;
+        expression(parser);
+        emitByte(parser, OP_POP);
+        consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+        emitLoop(parser, loopStart); // go back to main top loop. happens agian right after the increment clause. since the increment executes at the end of each loop iteration.
         loopStart = incrementStart; // change loopStart to point to the offset where the increment expression begins.
-        patchJump(bodyJump);
+        patchJump(parser, bodyJump);
     }
 
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
-
-    statement();
-    emitLoop(loopStart); // after execute body, go back to increment expression
+    statement(parser);
+    emitLoop(parser, loopStart); // after execute body, go back to increment expression
 
     // After the loop body, we need to patch that jump.
     // do this only when there is a condition clause. 
     // If there isn't, there's no jump to patch and no condition value on the stack to pop.
     if (exitJump != -1) {
-        patchJump(exitJump);
-        emitByte(OP_POP); // pop Condition value.
+        patchJump(parser, exitJump);
+        emitByte(parser, OP_POP); // pop Condition value.
     }
 
-    endScope();
+    endScope(parser);
 }
 
 /*
@@ -553,27 +1385,44 @@ static void forStatement() {
 
     위를 다 compile 해둠
 */
-static void ifStatement() {
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.)");
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+static void ifStatement(Parser* parser) {
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.)");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP); // (2)
-    statement(); // then branch statement
+    int thenJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    emitByte(parser, OP_POP); // (2)
+    statement(parser); // then branch statement
 
-    int elseJump = emitJump(OP_JUMP); // (3)
-    patchJump(thenJump);
-    emitByte(OP_POP); // (4)
+    int elseJump = emitJump(parser, OP_JUMP); // (3)
+    patchJump(parser, thenJump);
+    emitByte(parser, OP_POP); // (4)
 
-    if (match(TOKEN_ELSE)) statement();
-    patchJump(elseJump);
+    if (match(parser, TOKEN_ELSE)) statement(parser);
+    patchJump(parser, elseJump);
 }
 
-static void printStatement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-    emitByte(OP_PRINT);
+static void printStatement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+    emitByte(parser, OP_PRINT);
+}
+
+static void returnStatement(Parser* parser) {
+    if (parser->compiler->type == TYPE_SCRIPT) {
+        error(parser, "Can't return from top-level code.");
+    }
+
+    if (match(parser, TOKEN_SEMICOLON)) {
+        emitReturn(parser);
+    } else {
+        if (parser->compiler->type == TYPE_INITIALIZER) {
+            error(parser, "Can't return a value from an initializer.");
+        }
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
+        emitByte(parser, OP_RETURN);
+    }
 }
 
 /*
@@ -585,32 +1434,33 @@ static void printStatement() {
         (4) OP_POP
     - continue..
 */
-static void whileStatement() {
-    int loopStart = currentChunk()->count;
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
-
-    int exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
-    statement();
-    emitLoop(loopStart);
-
-    patchJump(exitJump);
-    emitByte(OP_POP);
+static void whileStatement(Parser* parser) {
+    int loopStart = currentChunk(parser)->count;
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+    int exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    emitByte(parser, OP_POP);
+    statement(parser);
+    emitLoop(parser, loopStart);
+
+    patchJump(parser, exitJump);
+    emitByte(parser, OP_POP);
 }
 
-static void synchronize() {
-    parser.panicMode = false;
+static void synchronize(Parser* parser) {
+    parser->panicMode = false;
 
-    while (parser.current.type != TOKEN_EOF) {
-        if (parser.previous.type == TOKEN_SEMICOLON) return;
-        switch (parser.current.type) {
+    while (parser->current.type != TOKEN_EOF) {
+        if (parser->previous.type == TOKEN_SEMICOLON) return;
+        switch (parser->current.type) {
             case TOKEN_CLASS:
             case TOKEN_FUN:
             case TOKEN_VAR:
             case TOKEN_FOR:
             case TOKEN_IF:
+            case TOKEN_SWITCH:
             case TOKEN_WHILE:
             case TOKEN_PRINT:
             case TOKEN_RETURN:
@@ -620,111 +1470,205 @@ static void synchronize() {
                 ;
         }
 
-        advance();
+        advance(parser);
     }
 }
 
-static void declaration() {
-    if (match(TOKEN_VAR)) {
-        varDeclaration();
+static void declaration(Parser* parser) {
+    if (match(parser, TOKEN_CLASS)) {
+        classDeclaration(parser);
+    } else if (match(parser, TOKEN_FUN)) {
+        funDeclaration(parser);
+    } else if (match(parser, TOKEN_VAR)) {
+        varDeclaration(parser);
     } else {
-        statement();
-    }
-
-    if (parser.panicMode) sychronize();
-}
-
-// statement -> exprStmt | printStmt | block;
-static void statement() {
-    if (match(TOKEN_PRINT)) {
-        printStatement();
-    } else if (match(TOKEN_FOR)){
-        forStatement();
-    } else if (match(TOKEN_IF)) {
-        ifStatement();
-    } else if (match(TOKEN_WHILE)){
-        whileStatement();
-    } else if (match(TOKEN_LEFT_BRACE)) {
-        beginScope();
-        block();
-        endScope();
+        statement(parser);
+    }
+
+    if (parser->panicMode) synchronize(parser);
+}
+
+// statement -> exprStmt | printStmt | forStmt | ifStmt | returnStmt | switchStmt | whileStmt | block;
+static void statement(Parser* parser) {
+    if (match(parser, TOKEN_PRINT)) {
+        printStatement(parser);
+    } else if (match(parser, TOKEN_FOR)){
+        forStatement(parser);
+    } else if (match(parser, TOKEN_IF)) {
+        ifStatement(parser);
+    } else if (match(parser, TOKEN_RETURN)) {
+        returnStatement(parser);
+    } else if (match(parser, TOKEN_SWITCH)) {
+        switchStatement(parser);
+    } else if (match(parser, TOKEN_WHILE)){
+        whileStatement(parser);
+    } else if (match(parser, TOKEN_LEFT_BRACE)) {
+        beginScope(parser);
+        block(parser);
+        endScope(parser);
     } else {
-        expressionStatement();
+        expressionStatement(parser);
     }
 }
 
-static void grouping(bool canAssign) {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+static void grouping(Parser* parser, bool canAssign) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-static void number(bool canAssign) {
-    /*
-     * strtod: 문자 스트링을 double, float 또는 long double 값으로 변환.
-     * */
-    double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+static void number(Parser* parser, bool canAssign) {
+    emitConstant(parser, NUMBER_VAL(parseNumber(&parser->previous)));
+    parser->compiler->lastType = typeOf(TYPE_NUMBER);
 }
 
-static void or_(bool canAssign) {
-    int elseJump = emitJump(OP_JUMP_IF_FALSE);
-    int endJump = emitJump(OP_JUMP);
+static void or_(Parser* parser, bool canAssign) {
+    ExprType left = parser->compiler->leftType;
+    int elseJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    int endJump = emitJump(parser, OP_JUMP);
 
-    patchJump(elseJump);
-    emitByte(OP_POP);
+    patchJump(parser, elseJump);
+    emitByte(parser, OP_POP);
 
-    parsePrecedence(PREC_OR);
-    patchJump(endJump);
+    parsePrecedence(parser, PREC_OR);
+    patchJump(parser, endJump);
+    parser->compiler->lastType = joinTypes(left, parser->compiler->lastType);
 }
 
-static void string(bool canAssign) {
+static void string(Parser* parser, bool canAssign) {
     // [0, length -1] 이 아닌 이유는 leading and trailing quotation mark 를 제거하기 위함.
-    emitConstant(OBJ_VAL(copyString(
-        parser.previous.start + 1, parser.previous.length - 2)));
+    emitConstant(parser, OBJ_VAL(copyString(parser->vm,
+        parser->previous.start + 1, parser->previous.length - 2)));
+    parser->compiler->lastType = typeOf(TYPE_STRING);
 }
 
-static void namedVariable(Token name, bool canAssign) {
+/*
+"a ${x} b ${y}" arrives as TOKEN_INTERPOLATION "a ${, x, TOKEN_INTERPOLATION "} b ${, y, TOKEN_STRING "}".
+Each literal piece (empty ones are left out) and each expression is pushed, and one
+OP_BUILD_STRING joins them all, instead of an OP_ADD and an intermediate string per piece.
+*/
+static void interpolation(Parser* parser, bool canAssign) {
+    int parts = 0;
+    do {
+        // the piece between the leading '"' or '}' and the "${".
+        if (parser->previous.length > 3) {
+            emitConstant(parser, OBJ_VAL(copyString(parser->vm,
+                parser->previous.start + 1, parser->previous.length - 3)));
+            parts++;
+        }
+        if ((check(parser, TOKEN_STRING) || check(parser, TOKEN_INTERPOLATION)) &&
+            parser->current.start[0] == '}') {
+            // "${}": the '}' starts the string token that follows, so report it on its own.
+            Token brace = parser->current;
+            brace.length = 1;
+            errorAt(parser, &brace, "Expect expression.");
+            continue;
+        }
+        expression(parser);
+        parts++;
+    } while (match(parser, TOKEN_INTERPOLATION));
+
+    consume(parser, TOKEN_STRING, "Expect end of string interpolation.");
+    if (parser->previous.length > 2) {
+        emitConstant(parser, OBJ_VAL(copyString(parser->vm,
+            parser->previous.start + 1, parser->previous.length - 2)));
+        parts++;
+    }
+
+    if (parts > UINT8_MAX) {
+        error(parser, "Too many parts in string interpolation.");
+    }
+    emitBytes(parser, OP_BUILD_STRING, (uint8_t)parts);
+    adjustStack(parser, -parts);
+    parser->compiler->lastType = typeOf(TYPE_STRING);
+}
+
+static void namedVariable(Parser* parser, Token name, bool canAssign) {
     // uint8_t arg = identifierConstant(&name);
     uint8_t getOp, setOp;
-    int arg = resolveLocal(current, &name);
+    int arg = resolveLocal(parser, parser->compiler, &name);
     if (arg != -1) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
+    } else if ((arg = resolveUpvalue(parser, parser->compiler, &name)) != -1) {
+        getOp = OP_GET_UPVALUE;
+        setOp = OP_SET_UPVALUE;
     } else {
-        arg = identifierConstant(&name);
+        arg = identifierConstant(parser, &name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
 
     // compiler가 '=' 이 있으면 setter, 없으면 getter로 구분
-    if (canAssign && match(TOKEN_EQUAL)) {
-        expression();
-        emitBytes(setOp, (uint8_t)arg);
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        if (setOp == OP_SET_LOCAL) assignLocal(parser, arg, parser->compiler->lastType);
+        emitBytes(parser, setOp, (uint8_t)arg);
+        // the assignment's value is the assigned value, so lastType stays as it is.
     } else {
-        emitBytes(getOp, (uint8_t)arg);
+        emitBytes(parser, getOp, (uint8_t)arg);
+        if (getOp == OP_GET_LOCAL) parser->compiler->lastType = localType(parser, arg);
     }
+}
 
-    emitBytes(OP_GET_GLOBAL, arg);
+static void variable(Parser* parser, bool canAssign) {
+    namedVariable(parser, parser->previous, canAssign);
 }
 
-static void variable(bool canAssign) {
-    namedVariable(parser.previous, canAssign);
+// 'this' is an ordinary local in slot 0 of a method, so closures inside methods capture it like any other.
+static void this_(Parser* parser, bool canAssign) {
+    if (parser->classCompiler == NULL) {
+        error(parser, "Can't use 'this' outside of a class.");
+        return;
+    }
+    variable(parser, false);
 }
 
-static void unary(bool canAssign) {
+// super.name(args) compiles to OP_SUPER_INVOKE; a bare super.name to OP_GET_SUPER, which binds it.
+static void super_(Parser* parser, bool canAssign) {
+    if (parser->classCompiler == NULL) {
+        error(parser, "Can't use 'super' outside of a class.");
+    } else if (!parser->classCompiler->hasSuperclass) {
+        error(parser, "Can't use 'super' in a class with no superclass.");
+    }
+
+    consume(parser, TOKEN_DOT, "Expect '.' after 'super'.");
+    consume(parser, TOKEN_IDENTIFIER, "Expect superclass method name.");
+    uint8_t name = identifierConstant(parser, &parser->previous);
+
+    namedVariable(parser, syntheticToken("this"), false);
+    if (match(parser, TOKEN_LEFT_PAREN)) {
+        ExprType types;
+        uint8_t argCount = argumentList(parser, &types);
+        namedVariable(parser, syntheticToken("super"), false);
+        emitInvoke(parser, OP_SUPER_INVOKE, name, argCount);
+    } else {
+        namedVariable(parser, syntheticToken("super"), false);
+        emitBytes(parser, OP_GET_SUPER, name);
+        parser->compiler->lastType = typeOf(TYPE_UNKNOWN);
+    }
+}
+
+static void unary(Parser* parser, bool canAssign) {
     /*
-    The leading - token has been consumed and is sitting in parser.previous.
+    The leading - token has been consumed and is sitting in parser->previous.
     We grab the token type from that to note which unary operator we’re dealing with.
     */
-    TokenType operatorType = parser.previous.type;
+    TokenType operatorType = parser->previous.type;
 
     // Compile the operand.
-    parsePrecedence(PREC_UNARY);
+    parsePrecedence(parser, PREC_UNARY);
+    ExprType operand = parser->compiler->lastType;
 
     // Emit the operator instruction.
     switch (operatorType) {
-        case TOKEN_BANG: emitByte(OP_NOT); break;
-        case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+        case TOKEN_BANG:
+            emitByte(parser, OP_NOT);
+            parser->compiler->lastType = typeOf(TYPE_BOOL);
+            break;
+        case TOKEN_MINUS:
+            emitChecked(parser, OP_NEGATE, OP_NEGATE_NUM, operand.type == TYPE_NUMBER, &operand.deps);
+            parser->compiler->lastType = typeOf(TYPE_NUMBER);
+            break;
         default: return; // Unreachable.
     }
 }
@@ -740,12 +1684,15 @@ static void unary(bool canAssign) {
  * the precedence of an infix expression that uses that token as an operator.
  * */
 ParseRule rules[] = {
-        [TOKEN_LEFT_PAREN]    = {grouping, NULL, PREC_NONE},
+        [TOKEN_LEFT_PAREN]    = {grouping, call, PREC_CALL},
         [TOKEN_RIGHT_PAREN]   = {NULL, NULL, PREC_NONE},
         [TOKEN_LEFT_BRACE]    = {NULL, NULL, PREC_NONE},
         [TOKEN_RIGHT_BRACE]   = {NULL, NULL, PREC_NONE},
+        [TOKEN_LEFT_BRACKET]  = {arrayLiteral, index_, PREC_CALL},
+        [TOKEN_RIGHT_BRACKET] = {NULL, NULL, PREC_NONE},
+        [TOKEN_COLON]         = {NULL, NULL, PREC_NONE},
         [TOKEN_COMMA]         = {NULL, NULL, PREC_NONE},
-        [TOKEN_DOT]           = {NULL, NULL, PREC_NONE},
+        [TOKEN_DOT]           = {NULL, dot, PREC_CALL},
         [TOKEN_MINUS]         = {unary, binary, PREC_TERM},
         [TOKEN_PLUS]          = {NULL, binary, PREC_TERM},
         [TOKEN_SEMICOLON]     = {NULL, NULL, PREC_NONE},
@@ -762,8 +1709,11 @@ ParseRule rules[] = {
         [TOKEN_IDENTIFIER]    = {variable, NULL, PREC_NONE},
         [TOKEN_STRING]        = {string, NULL, PREC_NONE},
         [TOKEN_NUMBER]        = {number, NULL, PREC_NONE},
+        [TOKEN_INTERPOLATION] = {interpolation, NULL, PREC_NONE},
         [TOKEN_AND]           = {NULL, and_, PREC_AND},
+        [TOKEN_CASE]          = {NULL, NULL, PREC_NONE},
         [TOKEN_CLASS]         = {NULL, NULL, PREC_NONE},
+        [TOKEN_DEFAULT]       = {NULL, NULL, PREC_NONE},
         [TOKEN_ELSE]          = {NULL, NULL, PREC_NONE},
         [TOKEN_FALSE]         = {literal, NULL, PREC_NONE},
         [TOKEN_FOR]           = {NULL, NULL, PREC_NONE},
@@ -773,8 +1723,9 @@ ParseRule rules[] = {
         [TOKEN_OR]            = {NULL, or_, PREC_OR},
         [TOKEN_PRINT]         = {NULL, NULL, PREC_NONE},
         [TOKEN_RETURN]        = {NULL, NULL, PREC_NONE},
-        [TOKEN_SUPER]         = {NULL, NULL, PREC_NONE},
-        [TOKEN_THIS]          = {NULL, NULL, PREC_NONE},
+        [TOKEN_SUPER]         = {super_, NULL, PREC_NONE},
+        [TOKEN_SWITCH]        = {NULL, NULL, PREC_NONE},
+        [TOKEN_THIS]          = {this_, NULL, PREC_NONE},
         [TOKEN_TRUE]          = {literal, NULL, PREC_NONE},
         [TOKEN_VAR]           = {NULL, NULL, PREC_NONE},
         [TOKEN_WHILE]         = {NULL, NULL, PREC_NONE},
@@ -787,21 +1738,35 @@ static ParseRule* getRule(TokenType type) {
 }
 
 // Scan -> Parse -> Compile -> Interpret
-bool compile(const char* source, Chunk* chunk) {
-    initScanner(source);
-    Compiler compiler;
-    initCompiler(&compiler);
-    compilingChunk = chunk;
-
+ObjFunction* compile(VM* vm, const char* source, size_t length, CompileStats* stats) {
+    Parser parser;
+    parser.vm = vm;
+    parser.compiler = NULL;
+    parser.classCompiler = NULL;
+    parser.functions = 0;
     parser.hadError = false;
     parser.panicMode = false;
+    parser.tokens = 0;
+
+    // big scripts overlap scanning and compiling; if the thread can't start, scan inline.
+    parser.ring = length >= PIPELINE_MIN_SOURCE ? startPipeline(source, length) : NULL;
+    if (parser.ring == NULL) initScanner(&parser.scanner, source, length);
 
-    advance();
+    Compiler compiler;
+    initCompiler(&parser, &compiler, TYPE_SCRIPT);
+
+    advance(&parser);
 
-    while (!match(TOKEN_EOF)) {
-        declaration();
+    while (!match(&parser, TOKEN_EOF)) {
+        declaration(&parser);
     }
 
-    endCompiler();
-    return !parser.hadError;
+    ObjFunction* function = endCompiler(&parser);
+    if (parser.ring != NULL) stopPipeline(parser.ring);
+
+    if (stats != NULL) {
+        stats->tokens = parser.tokens;
+        stats->lines = parser.current.line;
+    }
+    return parser.hadError ? NULL : function;
 }
@@ -4,6 +4,15 @@
 #include "object.h"
 #include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+#define FUNCTION_NESTING_MAX 64 // functions declared inside other functions, below the script.
+
+// counters from one compile(), reported by --compile-only.
+typedef struct {
+    long tokens;
+    int lines;
+} CompileStats;
+
+// returns the top-level code as a function, or NULL on a compile error. stats may be NULL.
+ObjFunction* compile(VM* vm, const char* source, size_t length, CompileStats* stats);
 
 #endif
\ No newline at end of file
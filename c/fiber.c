@@ -0,0 +1,94 @@
+// mmap(MAP_ANONYMOUS) is POSIX/BSD, not ISO C.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "fiber.h"
+#include "memory.h"
+#include "vm.h"
+
+#define FRAMES_BYTES (sizeof(CallFrame) * FRAMES_MAX)
+#define STACK_BYTES (sizeof(Value) * FIBER_STACK_MAX)
+
+void initFiberPool(FiberPool* pool) {
+    pool->free = NULL;
+    pool->guardSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t usable = FRAMES_BYTES + STACK_BYTES;
+    usable = (usable + pool->guardSize - 1) / pool->guardSize * pool->guardSize;
+    pool->blockSize = usable + pool->guardSize;
+    pool->slabs = NULL;
+    pool->slabCount = 0;
+    pool->slabCapacity = 0;
+}
+
+void freeFiberPool(FiberPool* pool) {
+    for (int i = 0; i < pool->slabCount; i++) {
+        munmap(pool->slabs[i], pool->blockSize * FIBER_SLAB_STACKS);
+    }
+    FREE_ARRAY(void*, pool->slabs, pool->slabCapacity);
+    initFiberPool(pool);
+}
+
+// maps FIBER_SLAB_STACKS more blocks, guards them, and puts them on the free list.
+// False if the mapping or a guard page can't be had (out of address space, or of mappings).
+static bool addSlab(FiberPool* pool) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    size_t slabSize = pool->blockSize * FIBER_SLAB_STACKS;
+    char* slab = mmap(NULL, slabSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (slab == MAP_FAILED) return false;
+
+    // every guard page splits the mapping in two, so this is where vm.max_map_count runs out.
+    for (int i = 0; i < FIBER_SLAB_STACKS; i++) {
+        char* block = slab + pool->blockSize * i;
+        if (mprotect(block + pool->blockSize - pool->guardSize, pool->guardSize, PROT_NONE) != 0) {
+            munmap(slab, slabSize);
+            return false;
+        }
+    }
+
+    if (pool->slabCapacity < pool->slabCount + 1) {
+        int oldCapacity = pool->slabCapacity;
+        pool->slabCapacity = GROW_CAPACITY(oldCapacity);
+        pool->slabs = GROW_ARRAY(void*, pool->slabs, oldCapacity, pool->slabCapacity);
+    }
+    pool->slabs[pool->slabCount++] = slab;
+
+    for (int i = FIBER_SLAB_STACKS - 1; i >= 0; i--) {
+        char* block = slab + pool->blockSize * i;
+        *(void**)block = pool->free;
+        pool->free = block;
+    }
+    return true;
+}
+
+bool acquireFiberStack(FiberPool* pool, ObjFiber* fiber) {
+    if (pool->free == NULL && !addSlab(pool)) return false;
+    char* block = pool->free;
+    pool->free = *(void**)block;
+
+    // frames at the start, the stack against the guard page at the end.
+    fiber->frames = (CallFrame*)block;
+    fiber->frameCount = 0;
+    fiber->stack = (Value*)(block + pool->blockSize - pool->guardSize - STACK_BYTES);
+    fiber->stackCapacity = FIBER_STACK_MAX;
+    fiber->stackTop = fiber->stack;
+    fiber->openUpvalues = NULL;
+    return true;
+}
+
+void releaseFiberStack(FiberPool* pool, ObjFiber* fiber) {
+    char* block = (char*)fiber->frames;
+    *(void**)block = pool->free;
+    pool->free = block;
+
+    fiber->frames = NULL;
+    fiber->frameCount = 0;
+    fiber->stack = NULL;
+    fiber->stackCapacity = 0;
+    fiber->stackTop = NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef clox_fiber_h
+#define clox_fiber_h
+
+#include "common.h"
+#include "object.h"
+
+#define FIBER_STACK_MAX 4096 // values on one fiber's stack.
+#define FIBER_SLAB_STACKS 16 // stacks mapped at once when the pool runs dry.
+
+/*
+Where fiber stacks come from. A script may make thousands of fibers, so a stack is not
+its own allocation: each is a fixed-size block cut from a bigger mapping (a slab), and a
+finished fiber's block goes on a free list for the next fiber that starts.
+
+A block holds the fiber's FRAMES_MAX call frames, then its value stack, then a PROT_NONE guard page,
+so overflowing a fiber's stack faults like overflowing the VM's (see reserveStack() in vm.c).
+The pages are only committed when touched, so a fiber that stays shallow costs a page or
+two of memory, whatever FIBER_STACK_MAX is.
+
+Each VM has its own pool, so it needs no lock.
+*/
+typedef struct {
+    void* free;       // free blocks, each holding the next one's address in its first bytes.
+    size_t blockSize; // frames, stack and guard page, rounded to whole pages.
+    size_t guardSize; // one page.
+    void** slabs;
+    int slabCount;
+    int slabCapacity;
+} FiberPool;
+
+void initFiberPool(FiberPool* pool);
+// unmaps every stack, including those of fibers that never finished.
+void freeFiberPool(FiberPool* pool);
+// sets the fiber's frames and stack; it starts empty. False, leaving the fiber as it was,
+// when no more stacks can be mapped.
+bool acquireFiberStack(FiberPool* pool, ObjFiber* fiber);
+// gives them back; the fiber doesn't run again.
+void releaseFiberStack(FiberPool* pool, ObjFiber* fiber);
+
+#endif
@@ -1,13 +1,28 @@
+// mmap(), fstat(), open_memstream() and friends are POSIX, not ISO C.
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "common.h"
-#include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
+#include "memory.h"
+#include "profile.h"
+#include "sampler.h"
+#include "scheduler.h"
+#include "trace.h"
 #include "vm.h"
 
-static void repl() {
+static void repl(VM* vm) {
     char line[1024];
     for (;;) {
         printf("> ");
@@ -15,59 +30,427 @@ static void repl() {
             printf("\n");
             break;
         }
-        interpret(line);
+        interpret(vm, line, strlen(line));
     }
 }
 
-// fseek(), ftell(), reward() 까지 에러핸들링을 하진 않았음.
-static char* readFile(const char* path) {
-    FILE* file = fopen(path, "rb");
-    if (file == NULL) {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(74);
+/*
+ * The script is mapped read-only and scanned in place instead of being copied into a malloc'd buffer.
+ * Tokens and the scanner only ever point into this mapping, and everything that outlives
+ * the compile (string constants) is copied onto the heap, so it can be unmapped right after interpret().
+ * The mapping is not NUL-terminated; the scanner stops at source + length.
+ */
+typedef struct {
+    const char* chars;
+    size_t length;
+} Source;
+
+// returns NULL on success, or what went wrong.
+static const char* mapFile(const char* path, Source* source) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return "Could not open file";
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return "Could not read file";
     }
 
-    // we don't know the size of the file, so seek to the very end using fseek and ftell to get the file size
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
+    source->length = (size_t)st.st_size;
+    source->chars = "";
 
-    char* buffer = (char*)malloc(fileSize + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
+    // mmap() rejects a zero length, and an empty script has nothing to map anyway.
+    if (source->length > 0) {
+        void* mapped = mmap(NULL, source->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            return "Could not read file";
+        }
+        posix_madvise(mapped, source->length, POSIX_MADV_SEQUENTIAL); // the scanner reads front to back exactly once.
+        source->chars = (const char*)mapped;
     }
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    if (bytesRead < fileSize) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
+
+    close(fd); // the mapping stays valid after the descriptor is closed.
+    return NULL;
+}
+
+static Source readFile(const char* path) {
+    Source source;
+    const char* error = mapFile(path, &source);
+    if (error != NULL) {
+        fprintf(stderr, "%s \"%s\".\n", error, path);
         exit(74);
     }
-    buffer[bytesRead] = '\0';
+    return source;
+}
+
+static void freeSource(Source source) {
+    if (source.length > 0) munmap((void*)source.chars, source.length);
+}
+
+static int exitStatus(InterpreterResult result) {
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+static void runFile(VM* vm, const char* path) {
+    Source source = readFile(path);
+    InterpreterResult result = interpret(vm, source.chars, source.length);
+    freeSource(source);
+
+    int status = exitStatus(result);
+    if (status != 0) exit(status);
+}
+static double elapsedSeconds(struct timespec start, struct timespec end) {
+    return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+typedef struct {
+    int functions;
+    int bytes;
+    int constants;
+} CodeSize;
+
+// the script and every function nested in it; those are constants of the code that declares them.
+// prints a line per chunk on the way, each nested function indented under the code declaring it.
+static void measureCode(ObjFunction* function, int depth, CodeSize* size) {
+    const char* name = function->name == NULL ? "<script>" : function->name->chars;
+    int indent = depth * 2;
+    int width = indent < 24 ? 24 - indent : 0; // keeps the numbers in one column.
+    printf("chunk:     %*s%-*s %8d bytes %6d constants\n", indent, "", width, name,
+           function->chunk.count, function->chunk.constants.count);
+
+    size->functions++;
+    size->bytes += function->chunk.count;
+    size->constants += function->chunk.constants.count;
+    for (int i = 0; i < function->chunk.constants.count; i++) {
+        Value constant = function->chunk.constants.values[i];
+        if (IS_FUNCTION(constant)) measureCode(AS_FUNCTION(constant), depth + 1, size);
+    }
+}
+
+/*
+ * --compile-only: run just the front end (scan + parse + emit) and report its throughput.
+ * The code is never executed, so this measures the compiler by itself.
+ */
+static void compileFile(VM* vm, const char* path) {
+    Source source = readFile(path);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CompileStats stats;
+    ObjFunction* script = compile(vm, source.chars, source.length, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    freeSource(source);
+
+    if (script == NULL) exit(65);
+
+    double seconds = elapsedSeconds(start, end);
+    printf("file:      %s\n", path);
+    printf("source:    %zu bytes, %d lines, %ld tokens\n",
+           source.length, stats.lines, stats.tokens);
+    printf("compile:   %.3f ms\n", seconds * 1e3);
+    printf("lines/s:   %.0f\n", stats.lines / seconds);
+    printf("tokens/s:  %.0f\n", stats.tokens / seconds);
+
+    CodeSize size = {0, 0, 0};
+    measureCode(script, 0, &size);
+    printf("code:      %d functions, %d bytes of bytecode, %d constants\n",
+           size.functions, size.bytes, size.constants);
+}
+
+/*
+ * --jobs N: run many independent scripts in one process instead of one process each.
+ * N worker threads take scripts off a shared counter. Every script gets a fresh VM
+ * (its own stack, globals and strings) on the worker that picked it up, so scripts can't see each other.
+ * A script's print output and errors go to in-memory buffers, and main() writes them out in
+ * command-line order as soon as every earlier script has finished, so the combined output is
+ * the same as running the scripts one after another.
+ *
+ * --prelude <file> compiles that file once, up front, and every job VM looks strings up in the
+ * resulting intern table before its own (VM.sharedStrings), so names and literals the scripts
+ * have in common are allocated and hashed into a table once instead of once per script.
+ */
+typedef struct {
+    const char* path;
+    char* output;        // captured print output.
+    size_t outputLength;
+    char* errors;        // captured compile and runtime errors.
+    size_t errorsLength;
+    int status;          // the exit status clox would have had running this script alone.
+    size_t bytes;
+    double seconds;
+    bool done;           // guarded by JobQueue.lock.
+} Job;
+
+typedef struct {
+    Job* jobs;
+    int count;
+    atomic_int next;     // next job to hand out.
+    const Table* sharedStrings;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} JobQueue;
+
+static void runJob(Job* job, const Table* sharedStrings) {
+    FILE* out = open_memstream(&job->output, &job->outputLength);
+    FILE* err = open_memstream(&job->errors, &job->errorsLength);
+    if (out == NULL || err == NULL) exit(74);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Source source;
+    const char* error = mapFile(job->path, &source);
+    if (error != NULL) {
+        fprintf(err, "%s \"%s\".\n", error, job->path);
+        job->bytes = 0;
+        job->status = 74;
+    } else {
+        VM vm;
+        initVM(&vm, sharedStrings);
+        vm.out = out;
+        vm.err = err;
+        job->status = exitStatus(interpret(&vm, source.chars, source.length));
+        freeVM(&vm);
+        job->bytes = source.length;
+        freeSource(source);
+    }
 
-    fclose(file);
-    return buffer;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->seconds = elapsedSeconds(start, end);
+    fclose(out); // makes output/errors valid.
+    fclose(err);
 }
 
-static void runFile(const char* path) {
-    char* source = readFile(path);
-    InterpreterResult result = interpret(source);
-    free(source);
+static void* runWorker(void* arg) {
+    JobQueue* queue = arg;
+    for (;;) {
+        int index = atomic_fetch_add(&queue->next, 1);
+        if (index >= queue->count) return NULL;
+
+        Job* job = &queue->jobs[index];
+        runJob(job, queue->sharedStrings);
+
+        pthread_mutex_lock(&queue->lock);
+        job->done = true;
+        pthread_cond_broadcast(&queue->finished);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+// returns the exit status of the first script (in command-line order) that failed, or 0.
+static int runJobs(int workers, const Table* sharedStrings, int count, const char* paths[]) {
+    JobQueue queue;
+    queue.jobs = calloc((size_t)count, sizeof(Job));
+    if (queue.jobs == NULL) exit(1);
+    queue.count = count;
+    queue.sharedStrings = sharedStrings;
+    atomic_init(&queue.next, 0);
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.finished, NULL);
+    for (int i = 0; i < count; i++) queue.jobs[i].path = paths[i];
+
+    if (workers > count) workers = count;
+    if (workers < 1) workers = 1;
+    pthread_t* threads = malloc(sizeof(pthread_t) * (size_t)workers);
+    if (threads == NULL) exit(1);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&threads[i], NULL, runWorker, &queue) != 0) {
+            fprintf(stderr, "Could not start worker thread.\n");
+            exit(71);
+        }
+    }
+
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        Job* job = &queue.jobs[i];
+        pthread_mutex_lock(&queue.lock);
+        while (!job->done) pthread_cond_wait(&queue.finished, &queue.lock);
+        pthread_mutex_unlock(&queue.lock);
+
+        fwrite(job->output, 1, job->outputLength, stdout);
+        fflush(stdout);
+        fwrite(job->errors, 1, job->errorsLength, stderr);
+        free(job->output);
+        free(job->errors);
+        if (status == 0) status = job->status;
+    }
+
+    for (int i = 0; i < workers; i++) pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double wall = elapsedSeconds(start, end);
+
+    // the report goes to stderr so stdout is exactly the scripts' output.
+    double busy = 0;
+    size_t bytes = 0;
+    fprintf(stderr, "== jobs: %d scripts on %d threads, %d shared strings ==\n",
+            count, workers, sharedStrings != NULL ? sharedStrings->count : 0);
+    fprintf(stderr, "%6s %6s %10s %12s  %s\n", "job", "status", "ms", "KB/s", "path");
+    for (int i = 0; i < count; i++) {
+        Job* job = &queue.jobs[i];
+        busy += job->seconds;
+        bytes += job->bytes;
+        fprintf(stderr, "%6d %6d %10.3f %12.0f  %s\n", i, job->status, job->seconds * 1e3,
+                job->seconds > 0 ? job->bytes / 1024.0 / job->seconds : 0.0, job->path);
+    }
+    fprintf(stderr, "total: %.3f s wall, %.3f s in scripts (%.2fx concurrency)\n",
+            wall, busy, wall > 0 ? busy / wall : 0.0);
+    fprintf(stderr, "throughput: %.1f scripts/s, %.0f KB/s\n",
+            count / wall, bytes / 1024.0 / wall);
+
+    free(threads);
+    free(queue.jobs);
+    pthread_mutex_destroy(&queue.lock);
+    pthread_cond_destroy(&queue.finished);
+    return status;
+}
+
+/*
+ * --interleave <slice>: run every script at once on this one thread, switching between them
+ * round-robin whenever one has spent <slice> of budget. Output interleaves as the scripts run.
+ */
+typedef struct {
+    VM* vms;
+    int* statuses;
+} Interleaved;
 
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+static void recordStatus(VM* vm, InterpreterResult result, void* context) {
+    Interleaved* run = context;
+    run->statuses[vm - run->vms] = exitStatus(result);
 }
+
+static int runInterleaved(long slice, int count, const char* paths[]) {
+    Interleaved run;
+    run.vms = ALLOCATE(VM, count);
+    run.statuses = ALLOCATE(int, count);
+    Scheduler scheduler;
+    initScheduler(&scheduler, slice);
+
+    for (int i = 0; i < count; i++) {
+        initVM(&run.vms[i], NULL);
+        Source source = readFile(paths[i]);
+        InterpreterResult result = loadScript(&run.vms[i], source.chars, source.length);
+        freeSource(source);
+        run.statuses[i] = exitStatus(result);
+        if (result == INTERPRET_OK) scheduleVM(&scheduler, &run.vms[i]);
+    }
+    runScheduler(&scheduler, recordStatus, &run);
+
+    fprintf(stderr, "== interleave: %d scripts, %ld switches ==\n", count, scheduler.switches);
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        if (status == 0) status = run.statuses[i];
+        freeVM(&run.vms[i]);
+    }
+    freeScheduler(&scheduler);
+    FREE_ARRAY(VM, run.vms, count);
+    FREE_ARRAY(int, run.statuses, count);
+    return status;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: clox [--compile-only | --profile-lines] [path]\n");
+    fprintf(stderr, "       clox --trace <trace file> <path>\n");
+    fprintf(stderr, "       clox --decode-trace <trace file> <path>\n");
+    fprintf(stderr, "       clox --jobs <threads> [--prelude <path>] <path>...\n");
+    fprintf(stderr, "       clox --interleave <slice> <path>...\n");
+    exit(64);
+}
+
+static bool isFlag(const char* arg) {
+    return arg[0] == '-';
+}
+
+// the script paths at the end of --jobs and --interleave: at least one, and no misplaced or unknown flags.
+static void checkPaths(int count, const char* paths[]) {
+    if (count < 1) usage();
+    for (int i = 0; i < count; i++) {
+        if (isFlag(paths[i])) usage();
+    }
+}
+
+/*
+ * The first argument picks the mode, and each mode then checks the arguments it takes,
+ * so a flag is never mistaken for a path (or the other way round) because of how many
+ * arguments there happen to be.
+ */
 int main(int argc, const char* argv[]) {
-    initVM();
+    VM vm;
+    initVM(&vm, NULL);
+#ifdef PROFILE_OPCODES
+    atexit(profileReport); // also covers the exit() paths for compile and runtime errors.
+#endif
 
-    if (argc == 1) {
-        repl();
-    } else if (argc == 2) {
-        runFile(argv[1]);
+    const char* mode = argc > 1 ? argv[1] : NULL;
+    if (mode == NULL) {
+        repl(&vm);
+    } else if (!isFlag(mode)) {
+        if (argc != 2) usage();
+        runFile(&vm, mode);
+    } else if (strcmp(mode, "--compile-only") == 0) {
+        if (argc != 3 || isFlag(argv[2])) usage();
+        compileFile(&vm, argv[2]);
+    } else if (strcmp(mode, "--profile-lines") == 0) {
+        if (argc != 3 || isFlag(argv[2])) usage();
+        startSampling(argv[2]);
+        atexit(samplingReport);
+        runFile(&vm, argv[2]);
+    } else if (strcmp(mode, "--trace") == 0) {
+        if (argc != 4 || isFlag(argv[2]) || isFlag(argv[3])) usage();
+        vm.recorder = startTrace(argv[2]);
+        atexit(dumpTrace);
+        runFile(&vm, argv[3]);
+    } else if (strcmp(mode, "--decode-trace") == 0) {
+        if (argc != 4 || isFlag(argv[2]) || isFlag(argv[3])) usage();
+        Source source = readFile(argv[3]);
+        bool decoded = decodeTrace(&vm, argv[2], source.chars, source.length);
+        freeSource(source);
+        if (!decoded) exit(65);
+    } else if (strcmp(mode, "--jobs") == 0) {
+        if (argc < 3) usage();
+        int workers = atoi(argv[2]);
+        if (workers < 1) {
+            fprintf(stderr, "--jobs needs a thread count of at least 1.\n");
+            exit(64);
+        }
+        int first = 3;
+        const char* preludePath = NULL;
+        if (argc > 3 && strcmp(argv[3], "--prelude") == 0) {
+            if (argc < 5 || isFlag(argv[4])) usage();
+            preludePath = argv[4];
+            first = 5;
+        }
+        checkPaths(argc - first, &argv[first]);
+
+        const Table* sharedStrings = NULL;
+        if (preludePath != NULL) {
+            // main's own VM owns the shared strings; it is done changing before any worker starts.
+            Source prelude = readFile(preludePath);
+            bool compiled = compile(&vm, prelude.chars, prelude.length, NULL) != NULL;
+            freeSource(prelude);
+            if (!compiled) exit(65);
+            sharedStrings = &vm.strings;
+        }
+        int status = runJobs(workers, sharedStrings, argc - first, &argv[first]);
+        freeVM(&vm);
+        return status;
+    } else if (strcmp(mode, "--interleave") == 0) {
+        if (argc < 3) usage();
+        long slice = atol(argv[2]);
+        if (slice < 1) slice = SCHEDULER_SLICE;
+        checkPaths(argc - 3, &argv[3]);
+        int status = runInterleaved(slice, argc - 3, &argv[3]);
+        freeVM(&vm);
+        return status;
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        usage();
     }
 
-    freeVM();
+    freeVM(&vm);
     return 0;
 }
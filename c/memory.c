@@ -17,22 +17,80 @@ void* reallocate(void *pointer, size_t oldSize, size_t newSize) {
     return result;
 }
 
-void freeObjects() {
-    Obj* object = vm.objects;
-    while (object != NULL) {
-        Obj* next = object->next;
-        freeObject(object);
-        object = next;
-    }
-}
-
 static void freeObject(Obj* object) {
     switch (object->type) {
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            freeValueArray(&array->items);
+            FREE(ObjArray, object);
+            break;
+        }
+        case OBJ_BOUND_METHOD:
+            FREE(ObjBoundMethod, object);
+            break;
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)object;
+            freeTable(&klass->methods);
+            FREE(ObjClass, object);
+            break;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            reallocate(object, sizeof(ObjClosure) + sizeof(ObjUpvalue*) * closure->upvalueCount, 0);
+            break;
+        }
+        case OBJ_FIBER:
+            // its stack belongs to the VM's FiberPool, which is freed as a whole.
+            FREE(ObjFiber, object);
+            break;
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            freeChunk(&function->chunk);
+            FREE(ObjFunction, object);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+            FREE(ObjInstance, object);
+            break;
+        }
+        case OBJ_MAP:
+            freeValueTable(&((ObjMap*)object)->table);
+            FREE(ObjMap, object);
+            break;
+        case OBJ_NATIVE:
+            FREE(ObjNative, object);
+            break;
+        case OBJ_NUMBER_ARRAY: {
+            ObjNumberArray* array = (ObjNumberArray*)object;
+            FREE_ARRAY(double, array->items, array->capacity);
+            FREE(ObjNumberArray, object);
+            break;
+        }
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)object;
+            freeTable(&shape->transitions);
+            FREE(ObjShape, object);
+            break;
+        }
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
             FREE_ARRAY(char, string->chars, string->length + 1);
             FREE(ObjString, object);
             break;
         }
+        case OBJ_UPVALUE:
+            FREE(ObjUpvalue, object);
+            break;
     }
-}
\ No newline at end of file
+}
+
+void freeObjects(VM* vm) {
+    Obj* object = vm->objects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        freeObject(object);
+        object = next;
+    }
+}
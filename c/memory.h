@@ -20,5 +20,5 @@
     reallocate(pointer, sizeof(type) * (oldCount), 0)
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
-void freeObjects();
+void freeObjects(VM* vm);
 #endif
\ No newline at end of file
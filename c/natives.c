@@ -0,0 +1,483 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memory.h"
+#include "natives.h"
+#include "object.h"
+#include "simd.h"
+
+static bool clockNative(VM* vm, int argCount, Value* args) {
+    args[-1] = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+    return true;
+}
+
+static double modNative(double a, double b) {
+    return fmod(a, b); // Lox has no '%' operator.
+}
+
+static bool checkString(VM* vm, Value value, const char* message) {
+    if (IS_STRING(value)) return true;
+    runtimeError(vm, message);
+    return false;
+}
+
+// a whole number in [0, limit], for string offsets and lengths.
+static bool checkIndex(VM* vm, Value value, int limit, int* index) {
+    if (!IS_NUMBER(value)) {
+        runtimeError(vm, "Index must be a number.");
+        return false;
+    }
+    double number = AS_NUMBER(value);
+    if (number != floor(number) || number < 0 || number > limit) {
+        runtimeError(vm, "Index out of range.");
+        return false;
+    }
+    *index = (int)number;
+    return true;
+}
+
+static bool lenNative(VM* vm, int argCount, Value* args) {
+    if (IS_ARRAY(args[0])) {
+        args[-1] = NUMBER_VAL(AS_ARRAY(args[0])->items.count);
+    } else if (IS_NUMBER_ARRAY(args[0])) {
+        args[-1] = NUMBER_VAL(AS_NUMBER_ARRAY(args[0])->count);
+    } else if (IS_MAP(args[0])) {
+        args[-1] = NUMBER_VAL(AS_MAP(args[0])->table.count);
+    } else if (IS_STRING(args[0])) {
+        args[-1] = NUMBER_VAL(AS_STRING(args[0])->length);
+    } else {
+        runtimeError(vm, "Argument must be a string, an array or a map.");
+        return false;
+    }
+    return true;
+}
+
+// substr(s, start, length)
+static bool substrNative(VM* vm, int argCount, Value* args) {
+    if (!checkString(vm, args[0], "Argument must be a string.")) return false;
+    ObjString* string = AS_STRING(args[0]);
+    int start, length;
+    if (!checkIndex(vm, args[1], string->length, &start)) return false;
+    if (!checkIndex(vm, args[2], string->length - start, &length)) return false;
+
+    args[-1] = OBJ_VAL(copyString(vm, string->chars + start, length));
+    return true;
+}
+
+// indexOf(s, needle): offset of the first occurrence, or -1.
+static bool indexOfNative(VM* vm, int argCount, Value* args) {
+    if (!checkString(vm, args[0], "Arguments must be strings.")) return false;
+    if (!checkString(vm, args[1], "Arguments must be strings.")) return false;
+    ObjString* string = AS_STRING(args[0]);
+    ObjString* needle = AS_STRING(args[1]);
+
+    // strings can hold '\0' only through their length, so no strstr().
+    int index = -1;
+    for (int i = 0; i + needle->length <= string->length; i++) {
+        if (memcmp(string->chars + i, needle->chars, needle->length) == 0) {
+            index = i;
+            break;
+        }
+    }
+    args[-1] = NUMBER_VAL(index);
+    return true;
+}
+
+// str(value): the text print would show for it.
+static bool strNative(VM* vm, int argCount, Value* args) {
+    args[-1] = OBJ_VAL(valueToString(vm, args[0]));
+    return true;
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// a number literal as the scanner reads one (digits, then optionally '.' and more digits),
+// with an optional leading '-' so that num() reads back what str() writes for a negative integer.
+// strtod() alone would also take spaces, "inf", "nan", hex and exponents.
+static bool isNumberLiteral(const char* chars, int length) {
+    int i = 0;
+    if (i < length && chars[i] == '-') i++;
+
+    int digits = i;
+    while (i < length && isDigit(chars[i])) i++;
+    if (i == digits) return false;
+
+    if (i < length && chars[i] == '.') {
+        int fraction = ++i;
+        while (i < length && isDigit(chars[i])) i++;
+        if (i == fraction) return false;
+    }
+    return i == length;
+}
+
+// num(s): the number s spells as a Lox literal, or nil if it isn't one.
+static bool numNative(VM* vm, int argCount, Value* args) {
+    if (!checkString(vm, args[0], "Argument must be a string.")) return false;
+    ObjString* string = AS_STRING(args[0]);
+
+    if (!isNumberLiteral(string->chars, string->length)) {
+        args[-1] = NIL_VAL;
+        return true;
+    }
+    args[-1] = NUMBER_VAL(strtod(string->chars, NULL));
+    return true;
+}
+
+static bool checkNumberArray(VM* vm, Value value, ObjNumberArray** array) {
+    if (!IS_NUMBER_ARRAY(value)) {
+        runtimeError(vm, "Argument must be a number array.");
+        return false;
+    }
+    *array = AS_NUMBER_ARRAY(value);
+    return true;
+}
+
+// numbers(n) past this many bytes is refused rather than left for reallocate to fail on.
+#define NUMBER_ARRAY_MAX_BYTES ((size_t)1 << 30)
+
+/*
+numbers(n): a number array of n zeros.
+numbers(array): a number array with the same elements, which must all be numbers.
+*/
+static bool numbersNative(VM* vm, int argCount, Value* args) {
+    if (IS_NUMBER(args[0])) {
+        int count;
+        if (!checkIndex(vm, args[0], INT32_MAX, &count)) return false;
+        if ((size_t)count * sizeof(double) > NUMBER_ARRAY_MAX_BYTES) {
+            runtimeError(vm, "Array too large.");
+            return false;
+        }
+        args[-1] = OBJ_VAL(newNumberArray(vm, count));
+        return true;
+    }
+    if (!IS_ARRAY(args[0])) {
+        runtimeError(vm, "Argument must be a length or an array.");
+        return false;
+    }
+
+    ValueArray* items = &AS_ARRAY(args[0])->items;
+    ObjNumberArray* array = newNumberArray(vm, items->count);
+    for (int i = 0; i < items->count; i++) {
+        if (!IS_NUMBER(items->values[i])) {
+            runtimeError(vm, "Number arrays can only hold numbers.");
+            return false;
+        }
+        array->items[i] = AS_NUMBER(items->values[i]);
+    }
+    args[-1] = OBJ_VAL(array);
+    return true;
+}
+
+// push(array, value): appends, and returns the array.
+static bool pushNative(VM* vm, int argCount, Value* args) {
+    if (IS_ARRAY(args[0])) {
+        writeValueArray(&AS_ARRAY(args[0])->items, args[1]);
+    } else if (IS_NUMBER_ARRAY(args[0])) {
+        if (!IS_NUMBER(args[1])) {
+            runtimeError(vm, "Number arrays can only hold numbers.");
+            return false;
+        }
+        ObjNumberArray* array = AS_NUMBER_ARRAY(args[0]);
+        if (array->capacity < array->count + 1) {
+            int oldCapacity = array->capacity;
+            array->capacity = GROW_CAPACITY(oldCapacity);
+            array->items = GROW_ARRAY(double, array->items, oldCapacity, array->capacity);
+        }
+        array->items[array->count++] = AS_NUMBER(args[1]);
+    } else {
+        runtimeError(vm, "Argument must be an array.");
+        return false;
+    }
+    args[-1] = args[0];
+    return true;
+}
+
+// pop(array): removes and returns the last element.
+static bool popNative(VM* vm, int argCount, Value* args) {
+    if (IS_ARRAY(args[0]) && AS_ARRAY(args[0])->items.count > 0) {
+        ValueArray* items = &AS_ARRAY(args[0])->items;
+        args[-1] = items->values[--items->count];
+    } else if (IS_NUMBER_ARRAY(args[0]) && AS_NUMBER_ARRAY(args[0])->count > 0) {
+        ObjNumberArray* array = AS_NUMBER_ARRAY(args[0]);
+        args[-1] = NUMBER_VAL(array->items[--array->count]);
+    } else if (IS_ARRAY(args[0]) || IS_NUMBER_ARRAY(args[0])) {
+        runtimeError(vm, "Can't pop from an empty array.");
+        return false;
+    } else {
+        runtimeError(vm, "Argument must be an array.");
+        return false;
+    }
+    return true;
+}
+
+static bool sumNative(VM* vm, int argCount, Value* args) {
+    ObjNumberArray* array;
+    if (!checkNumberArray(vm, args[0], &array)) return false;
+    args[-1] = NUMBER_VAL(sumNumbers(array->items, array->count));
+    return true;
+}
+
+static bool dotNative(VM* vm, int argCount, Value* args) {
+    ObjNumberArray* a;
+    ObjNumberArray* b;
+    if (!checkNumberArray(vm, args[0], &a) || !checkNumberArray(vm, args[1], &b)) return false;
+    if (a->count != b->count) {
+        runtimeError(vm, "Arrays must have the same length.");
+        return false;
+    }
+    args[-1] = NUMBER_VAL(dotNumbers(a->items, b->items, a->count));
+    return true;
+}
+
+// scale(array, k): multiplies every element by k in place, and returns the array.
+static bool scaleNative(VM* vm, int argCount, Value* args) {
+    ObjNumberArray* array;
+    if (!checkNumberArray(vm, args[0], &array)) return false;
+    if (!IS_NUMBER(args[1])) {
+        runtimeError(vm, "Factor must be a number.");
+        return false;
+    }
+    scaleNumbers(array->items, array->count, AS_NUMBER(args[1]));
+    args[-1] = args[0];
+    return true;
+}
+
+// add(array, x): adds x, or x's elements pairwise, to every element in place, and returns the array.
+static bool addNative(VM* vm, int argCount, Value* args) {
+    ObjNumberArray* array;
+    if (!checkNumberArray(vm, args[0], &array)) return false;
+    if (IS_NUMBER(args[1])) {
+        addNumber(array->items, array->count, AS_NUMBER(args[1]));
+    } else if (IS_NUMBER_ARRAY(args[1])) {
+        ObjNumberArray* other = AS_NUMBER_ARRAY(args[1]);
+        if (other->count != array->count) {
+            runtimeError(vm, "Arrays must have the same length.");
+            return false;
+        }
+        addNumbers(array->items, other->items, array->count);
+    } else {
+        runtimeError(vm, "Can only add a number or a number array.");
+        return false;
+    }
+    args[-1] = args[0];
+    return true;
+}
+
+static int compareStrings(const void* a, const void* b) {
+    ObjString* x = AS_STRING(*(const Value*)a);
+    ObjString* y = AS_STRING(*(const Value*)b);
+    int length = x->length < y->length ? x->length : y->length;
+    int order = memcmp(x->chars, y->chars, length);
+    return order != 0 ? order : x->length - y->length;
+}
+
+/*
+sort(array): ascending, in place, and returns the array. A number array, or an array
+holding only numbers (sorted through a number array) or only strings.
+*/
+static bool sortNative(VM* vm, int argCount, Value* args) {
+    args[-1] = args[0];
+    if (IS_NUMBER_ARRAY(args[0])) {
+        sortNumbers(AS_NUMBER_ARRAY(args[0])->items, AS_NUMBER_ARRAY(args[0])->count);
+        return true;
+    }
+    if (!IS_ARRAY(args[0])) {
+        runtimeError(vm, "Argument must be an array.");
+        return false;
+    }
+
+    ValueArray* items = &AS_ARRAY(args[0])->items;
+    bool numbers = true, strings = true;
+    for (int i = 0; i < items->count; i++) {
+        numbers = numbers && IS_NUMBER(items->values[i]);
+        strings = strings && IS_STRING(items->values[i]);
+    }
+
+    if (numbers) {
+        double* unboxed = ALLOCATE(double, items->count);
+        for (int i = 0; i < items->count; i++) unboxed[i] = AS_NUMBER(items->values[i]);
+        sortNumbers(unboxed, items->count);
+        for (int i = 0; i < items->count; i++) items->values[i] = NUMBER_VAL(unboxed[i]);
+        FREE_ARRAY(double, unboxed, items->count);
+    } else if (strings) {
+        qsort(items->values, items->count, sizeof(Value), compareStrings);
+    } else {
+        runtimeError(vm, "Can only sort numbers or strings.");
+        return false;
+    }
+    return true;
+}
+
+// map(n) is only a hint, so past this many keys it reserves no more and the table grows as it fills.
+#define MAP_RESERVE_MAX (1 << 20)
+
+// map(), or map(n) with room for n keys up front, so filling it never rebuilds the table.
+static bool mapNative(VM* vm, int argCount, Value* args) {
+    if (argCount > 1) {
+        runtimeError(vm, "Expected 0 or 1 arguments but got %d.", argCount);
+        return false;
+    }
+    ObjMap* map = newMap(vm);
+    if (argCount == 1) {
+        int count;
+        if (!checkIndex(vm, args[0], INT32_MAX, &count)) return false;
+        valueTableReserve(&map->table, count < MAP_RESERVE_MAX ? count : MAP_RESERVE_MAX);
+    }
+    args[-1] = OBJ_VAL(map);
+    return true;
+}
+
+static bool checkMapArgs(VM* vm, Value* args, ValueTable** table) {
+    if (!IS_MAP(args[0])) {
+        runtimeError(vm, "Argument must be a map.");
+        return false;
+    }
+    if (!checkMapKey(vm, args[1])) return false;
+    *table = &AS_MAP(args[0])->table;
+    return true;
+}
+
+static bool hasNative(VM* vm, int argCount, Value* args) {
+    ValueTable* table;
+    if (!checkMapArgs(vm, args, &table)) return false;
+    Value value;
+    args[-1] = BOOL_VAL(valueTableGet(table, args[1], &value));
+    return true;
+}
+
+// remove(map, key): whether the key was there.
+static bool removeNative(VM* vm, int argCount, Value* args) {
+    ValueTable* table;
+    if (!checkMapArgs(vm, args, &table)) return false;
+    args[-1] = BOOL_VAL(valueTableDelete(table, args[1]));
+    return true;
+}
+
+// keys(map) / values(map): an array, in the order the keys were first set.
+static bool entriesNative(VM* vm, Value* args, bool keys) {
+    if (!IS_MAP(args[0])) {
+        runtimeError(vm, "Argument must be a map.");
+        return false;
+    }
+
+    ValueTable* table = &AS_MAP(args[0])->table;
+    ObjArray* array = newArray(vm);
+    if (table->count > 0) {
+        array->items.values = ALLOCATE(Value, table->count);
+        array->items.capacity = table->count;
+    }
+    for (int i = 0; i < table->entryCount; i++) {
+        MapEntry* entry = &table->entries[i];
+        if (entry->deleted) continue;
+        array->items.values[array->items.count++] = keys ? entry->key : entry->value;
+    }
+    args[-1] = OBJ_VAL(array);
+    return true;
+}
+
+static bool keysNative(VM* vm, int argCount, Value* args) {
+    return entriesNative(vm, args, true);
+}
+
+static bool valuesNative(VM* vm, int argCount, Value* args) {
+    return entriesNative(vm, args, false);
+}
+
+// fiber(fn): a fiber that runs fn when first resumed. fn takes no argument, or the first resume's value.
+static bool fiberNative(VM* vm, int argCount, Value* args) {
+    Value callee = IS_BOUND_METHOD(args[0]) ? AS_BOUND_METHOD(args[0])->method : args[0];
+    ObjFunction* function = IS_CLOSURE(callee) ? AS_CLOSURE(callee)->function
+                          : IS_FUNCTION(callee) ? AS_FUNCTION(callee) : NULL;
+    if (function == NULL) {
+        runtimeError(vm, "Argument must be a function.");
+        return false;
+    }
+    if (function->arity > 1) {
+        runtimeError(vm, "A fiber's function takes at most one argument.");
+        return false;
+    }
+    args[-1] = OBJ_VAL(newFiber(vm, args[0]));
+    return true;
+}
+
+static bool checkFiber(VM* vm, Value value) {
+    if (IS_FIBER(value)) return true;
+    runtimeError(vm, "Argument must be a fiber.");
+    return false;
+}
+
+// resume(fiber, value): runs the fiber until it yields or returns, and returns what it gave.
+static bool resumeNative(VM* vm, int argCount, Value* args) {
+    if (argCount < 1 || argCount > 2) {
+        runtimeError(vm, "Expected 1 or 2 arguments but got %d.", argCount);
+        return false;
+    }
+    if (!checkFiber(vm, args[0])) return false;
+    return resumeFiber(vm, AS_FIBER(args[0]), argCount == 2 ? args[1] : NIL_VAL, args - 1);
+}
+
+// yield(value): hands the value to the resume() that ran this fiber; returns the next resume's value.
+static bool yieldNative(VM* vm, int argCount, Value* args) {
+    if (argCount > 1) {
+        runtimeError(vm, "Expected 0 or 1 arguments but got %d.", argCount);
+        return false;
+    }
+    return yieldFiber(vm, argCount == 1 ? args[0] : NIL_VAL, args - 1);
+}
+
+static bool doneNative(VM* vm, int argCount, Value* args) {
+    if (!checkFiber(vm, args[0])) return false;
+    args[-1] = BOOL_VAL(AS_FIBER(args[0])->state == FIBER_DONE);
+    return true;
+}
+
+void defineNatives(VM* vm) {
+    defineNative(vm, "clock", 0, clockNative);
+
+    defineUnaryNative(vm, "abs", fabs);
+    defineUnaryNative(vm, "ceil", ceil);
+    defineUnaryNative(vm, "cos", cos);
+    defineUnaryNative(vm, "exp", exp);
+    defineUnaryNative(vm, "floor", floor);
+    defineUnaryNative(vm, "log", log);
+    defineUnaryNative(vm, "round", round);
+    defineUnaryNative(vm, "sin", sin);
+    defineUnaryNative(vm, "sqrt", sqrt);
+    defineUnaryNative(vm, "tan", tan);
+    defineBinaryNative(vm, "atan2", atan2);
+    defineBinaryNative(vm, "max", fmax);
+    defineBinaryNative(vm, "min", fmin);
+    defineBinaryNative(vm, "mod", modNative);
+    defineBinaryNative(vm, "pow", pow);
+
+    defineNative(vm, "indexOf", 2, indexOfNative);
+    defineNative(vm, "len", 1, lenNative);
+    defineNative(vm, "num", 1, numNative);
+    defineNative(vm, "str", 1, strNative);
+    defineNative(vm, "substr", 3, substrNative);
+
+    defineNative(vm, "add", 2, addNative);
+    defineNative(vm, "dot", 2, dotNative);
+    defineNative(vm, "numbers", 1, numbersNative);
+    defineNative(vm, "pop", 1, popNative);
+    defineNative(vm, "push", 2, pushNative);
+    defineNative(vm, "scale", 2, scaleNative);
+    defineNative(vm, "sort", 1, sortNative);
+    defineNative(vm, "sum", 1, sumNative);
+
+    defineNative(vm, "has", 2, hasNative);
+    defineNative(vm, "keys", 1, keysNative);
+    defineNative(vm, "map", -1, mapNative);
+    defineNative(vm, "remove", 2, removeNative);
+    defineNative(vm, "values", 1, valuesNative);
+
+    defineNative(vm, "done", 1, doneNative);
+    defineNative(vm, "fiber", 1, fiberNative);
+    defineNative(vm, "resume", -1, resumeNative);
+    defineNative(vm, "yield", -1, yieldNative);
+}
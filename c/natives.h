@@ -0,0 +1,13 @@
+#ifndef clox_natives_h
+#define clox_natives_h
+
+#include "vm.h"
+
+/*
+The built-in native functions every VM starts with, defined as globals by initVM().
+Math functions are registered with the typed signatures, straight from libm where
+one exists, so OP_CALL_NUM can call them without boxing.
+*/
+void defineNatives(VM* vm);
+
+#endif
@@ -1,4 +1,8 @@
+// open_memstream() is POSIX, not ISO C.
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "memory.h"
@@ -6,28 +10,146 @@
 #include "value.h"
 #include "vm.h"
 
-#define ALLOCATE_OBJ(type, objectType) \
-    (type*)allocateObject(sizeof(type), objectType)
+#define ALLOCATE_OBJ(vm, type, objectType) \
+    (type*)allocateObject(vm, sizeof(type), objectType)
+
+static Obj* allocateObject(VM* vm, size_t size, ObjType type);
+static ObjString* allocateString(VM* vm, char* chars, int length, uint32_t hash);
+static uint32_t hashString(const char* key, int length);
+
+ObjArray* newArray(VM* vm) {
+    ObjArray* array = ALLOCATE_OBJ(vm, ObjArray, OBJ_ARRAY);
+    initValueArray(&array->items);
+    return array;
+}
 
-ObjString* copyString(const char* chars, int length) {
+ObjBoundMethod* newBoundMethod(VM* vm, Value receiver, Value method) {
+    ObjBoundMethod* bound = ALLOCATE_OBJ(vm, ObjBoundMethod, OBJ_BOUND_METHOD);
+    bound->receiver = receiver;
+    bound->method = method;
+    return bound;
+}
+
+ObjClass* newClass(VM* vm, ObjString* name) {
+    ObjClass* klass = ALLOCATE_OBJ(vm, ObjClass, OBJ_CLASS);
+    klass->name = name;
+    initTable(&klass->methods);
+    klass->initializer = NIL_VAL;
+    klass->fieldHint = 0;
+    klass->version = 0;
+    return klass;
+}
+
+// the upvalue array is filled in by OP_CLOSURE right after this returns.
+ObjClosure* newClosure(VM* vm, ObjFunction* function) {
+    size_t size = sizeof(ObjClosure) + sizeof(ObjUpvalue*) * function->upvalueCount;
+    ObjClosure* closure = (ObjClosure*)allocateObject(vm, size, OBJ_CLOSURE);
+    closure->function = function;
+    closure->upvalueCount = function->upvalueCount;
+    return closure;
+}
+
+ObjFiber* newFiber(VM* vm, Value function) {
+    ObjFiber* fiber = ALLOCATE_OBJ(vm, ObjFiber, OBJ_FIBER);
+    fiber->function = function;
+    fiber->state = FIBER_NEW;
+    fiber->frames = NULL;
+    fiber->frameCount = 0;
+    fiber->stack = NULL;
+    fiber->stackCapacity = 0;
+    fiber->stackTop = NULL;
+    fiber->openUpvalues = NULL;
+    fiber->caller = NULL;
+    return fiber;
+}
+
+ObjFunction* newFunction(VM* vm) {
+    ObjFunction* function = ALLOCATE_OBJ(vm, ObjFunction, OBJ_FUNCTION);
+    function->arity = 0;
+    function->upvalueCount = 0;
+    function->name = NULL;
+    function->ordinal = 0;
+    initChunk(&function->chunk);
+    return function;
+}
+
+ObjInstance* newInstance(VM* vm, ObjClass* klass) {
+    ObjInstance* instance = ALLOCATE_OBJ(vm, ObjInstance, OBJ_INSTANCE);
+    instance->klass = klass;
+    instance->shape = vm->emptyShape;
+    instance->fieldCapacity = klass->fieldHint;
+    instance->fields = instance->fieldCapacity > 0 ? ALLOCATE(Value, instance->fieldCapacity) : NULL;
+    return instance;
+}
+
+ObjMap* newMap(VM* vm) {
+    ObjMap* map = ALLOCATE_OBJ(vm, ObjMap, OBJ_MAP);
+    initValueTable(&map->table);
+    return map;
+}
+
+ObjNative* newNative(VM* vm, ObjString* name, NativeSignature signature, int arity) {
+    ObjNative* native = ALLOCATE_OBJ(vm, ObjNative, OBJ_NATIVE);
+    native->name = name;
+    native->signature = signature;
+    native->arity = arity;
+    native->as.values = NULL;
+    return native;
+}
+
+ObjNumberArray* newNumberArray(VM* vm, int count) {
+    ObjNumberArray* array = ALLOCATE_OBJ(vm, ObjNumberArray, OBJ_NUMBER_ARRAY);
+    array->count = count;
+    array->capacity = count;
+    array->items = count > 0 ? ALLOCATE(double, count) : NULL;
+    if (count > 0) memset(array->items, 0, sizeof(double) * count);
+    return array;
+}
+
+ObjShape* newShape(VM* vm, ObjShape* parent, ObjString* name) {
+    ObjShape* shape = ALLOCATE_OBJ(vm, ObjShape, OBJ_SHAPE);
+    shape->parent = parent;
+    shape->name = name;
+    shape->fieldCount = parent != NULL ? parent->fieldCount + 1 : 0;
+    initTable(&shape->transitions);
+    return shape;
+}
+
+ObjUpvalue* newUpvalue(VM* vm, Value* slot) {
+    ObjUpvalue* upvalue = ALLOCATE_OBJ(vm, ObjUpvalue, OBJ_UPVALUE);
+    upvalue->location = slot;
+    upvalue->closed = NIL_VAL;
+    upvalue->next = NULL;
+    return upvalue;
+}
+
+static ObjString* findInterned(VM* vm, const char* chars, int length, uint32_t hash) {
+    if (vm->sharedStrings != NULL) {
+        ObjString* shared = tableFindString(vm->sharedStrings, chars, length, hash);
+        if (shared != NULL) return shared;
+    }
+    return tableFindString(&vm->strings, chars, length, hash);
+}
+
+ObjString* copyString(VM* vm, const char* chars, int length) {
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = findInterned(vm, chars, length, hash);
     if (interned != NULL) return interned;
     
     char* heapChars = ALLOCATE(char, length + 1);
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
 
-    return allocateString(heapChars, length, hash);
+    return allocateString(vm, heapChars, length, hash);
 }
 
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
-    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+static ObjString* allocateString(VM* vm, char* chars, int length, uint32_t hash) {
+    ObjString* string = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING);
     string -> length = length;
     string -> chars = chars;
     string -> hash = hash;
 
-    tableSet(&vm.strings, string, NIL_VAL);
+    tableSet(&vm->strings, string, NIL_VAL);
 
     return string;
 }
@@ -41,9 +163,9 @@ static uint32_t hashString(const char* key, int length) {
     return hash;
 }
 
-ObjString* takeString(char* chars, int length) {
+ObjString* takeString(VM* vm, char* chars, int length) {
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = findInterned(vm, chars, length, hash);
 
     if (interned != NULL) {
         // free the memory for the string that was passed in.
@@ -52,22 +174,110 @@ ObjString* takeString(char* chars, int length) {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
     }
-    return allocateString(chars, length, hash);
+    return allocateString(vm, chars, length, hash);
 }
 
-static Obj* allocateObject(size_t size, ObjType type) {
+static Obj* allocateObject(VM* vm, size_t size, ObjType type) {
     Obj* object = (Obj*)reallocate(NULL, 0, size);
     object -> type = type;
 
-    object->next = vm.objects;
-    vm.objects = object;
+    object->next = vm->objects;
+    vm->objects = object;
     return object;
 }
 
-void printObject(Value value) {
+static void printFunction(FILE* out, ObjFunction* function) {
+    if (function->name == NULL) {
+        fputs("<script>", out);
+        return;
+    }
+    fprintf(out, "<fn %s>", function->name->chars);
+}
+
+void printObject(FILE* out, Value value) {
     switch (OBJ_TYPE(value)) {
+        case OBJ_ARRAY: {
+            ValueArray* items = &AS_ARRAY(value)->items;
+            fputc('[', out);
+            for (int i = 0; i < items->count; i++) {
+                if (i > 0) fputs(", ", out);
+                fprintValue(out, items->values[i]);
+            }
+            fputc(']', out);
+            break;
+        }
+        case OBJ_BOUND_METHOD: {
+            Value method = AS_BOUND_METHOD(value)->method;
+            printFunction(out, IS_CLOSURE(method) ? AS_CLOSURE(method)->function : AS_FUNCTION(method));
+            break;
+        }
+        case OBJ_CLASS:
+            fputs(AS_CLASS(value)->name->chars, out);
+            break;
+        case OBJ_CLOSURE:
+            printFunction(out, AS_CLOSURE(value)->function);
+            break;
+        case OBJ_FIBER:
+            fputs("<fiber>", out);
+            break;
+        case OBJ_FUNCTION:
+            printFunction(out, AS_FUNCTION(value));
+            break;
+        case OBJ_INSTANCE:
+            fprintf(out, "%s instance", AS_INSTANCE(value)->klass->name->chars);
+            break;
+        case OBJ_MAP: {
+            ValueTable* table = &AS_MAP(value)->table;
+            bool first = true;
+            fputc('{', out);
+            for (int i = 0; i < table->entryCount; i++) {
+                MapEntry* entry = &table->entries[i];
+                if (entry->deleted) continue;
+                if (!first) fputs(", ", out);
+                fprintValue(out, entry->key);
+                fputs(": ", out);
+                fprintValue(out, entry->value);
+                first = false;
+            }
+            fputc('}', out);
+            break;
+        }
+        case OBJ_NATIVE:
+            fprintf(out, "<native fn %s>", AS_NATIVE(value)->name->chars);
+            break;
+        case OBJ_NUMBER_ARRAY: {
+            ObjNumberArray* array = AS_NUMBER_ARRAY(value);
+            fputc('[', out);
+            for (int i = 0; i < array->count; i++) {
+                if (i > 0) fputs(", ", out);
+                fprintValue(out, NUMBER_VAL(array->items[i]));
+            }
+            fputc(']', out);
+            break;
+        }
+        case OBJ_SHAPE:
+            fputs("shape", out); // never a value a script can see.
+            break;
         case OBJ_STRING:
-            printf("%s", AS_CSTRING(value));
+            fputs(AS_CSTRING(value), out);
+            break;
+        case OBJ_UPVALUE:
+            fputs("upvalue", out); // never a value a script can see.
             break;
     }
 }
+
+ObjString* valueToString(VM* vm, Value value) {
+    if (IS_STRING(value)) return AS_STRING(value);
+
+    char* chars;
+    size_t length;
+    FILE* out = open_memstream(&chars, &length);
+    if (out == NULL) exit(74);
+    fprintValue(out, value);
+    fclose(out);
+
+    ObjString* string = copyString(vm, chars, (int)length);
+    free(chars); // open_memstream() allocated it with malloc, not through reallocate().
+    return string;
+}
@@ -1,19 +1,55 @@
 #ifndef clox_object_h
 #define clox_object_h
 
+#include "chunk.h"
 #include "common.h"
+#include "table.h"
 #include "value.h"
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
+#define IS_ARRAY(value) isObjType(value, OBJ_ARRAY)
+#define IS_BOUND_METHOD(value) isObjType(value, OBJ_BOUND_METHOD)
+#define IS_CLASS(value) isObjType(value, OBJ_CLASS)
+#define IS_CLOSURE(value) isObjType(value, OBJ_CLOSURE)
+#define IS_FIBER(value) isObjType(value, OBJ_FIBER)
+#define IS_FUNCTION(value) isObjType(value, OBJ_FUNCTION)
+#define IS_INSTANCE(value) isObjType(value, OBJ_INSTANCE)
+#define IS_MAP(value) isObjType(value, OBJ_MAP)
+#define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
+#define IS_NUMBER_ARRAY(value) isObjType(value, OBJ_NUMBER_ARRAY)
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
 
+#define AS_ARRAY(value) ((ObjArray*)AS_OBJ(value))
+#define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
+#define AS_CLASS(value) ((ObjClass*)AS_OBJ(value))
+#define AS_CLOSURE(value) ((ObjClosure*)AS_OBJ(value))
+#define AS_FIBER(value) ((ObjFiber*)AS_OBJ(value))
+#define AS_FUNCTION(value) ((ObjFunction*)AS_OBJ(value))
+#define AS_INSTANCE(value) ((ObjInstance*)AS_OBJ(value))
+#define AS_MAP(value) ((ObjMap*)AS_OBJ(value))
+#define AS_NATIVE(value) ((ObjNative*)AS_OBJ(value))
+#define AS_NUMBER_ARRAY(value) ((ObjNumberArray*)AS_OBJ(value))
+#define AS_SHAPE(value) ((ObjShape*)AS_OBJ(value))
+
 // take a Value that is expected to contain a pointer to a valid ObjString on the heap.
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value)) // returns the ObjString *pointer.
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value)) -> chars) // return character array itself.
 
 typedef enum {
+    OBJ_ARRAY,
+    OBJ_BOUND_METHOD,
+    OBJ_CLASS,
+    OBJ_CLOSURE,
+    OBJ_FIBER,
+    OBJ_FUNCTION,
+    OBJ_INSTANCE,
+    OBJ_MAP,
+    OBJ_NATIVE,
+    OBJ_NUMBER_ARRAY,
+    OBJ_SHAPE,
     OBJ_STRING,
+    OBJ_UPVALUE,
 } ObjType;
 
 struct Obj {
@@ -28,9 +64,187 @@ struct ObjString {
     uint32_t hash;
 };
 
-ObjString* takeString(char* chars, int length);
-ObjString* copyString(const char* chars, int length);
-void printObject(Value value);
+/*
+Functions are first class: the compiler creates one per `fun` body (and one for the script),
+each with its own chunk, and they sit in the constant table of the code that declares them.
+*/
+struct ObjFunction {
+    Obj obj;
+    int arity;    // number of parameters.
+    Chunk chunk;
+    int upvalueCount; // variables it captures from enclosing functions.
+    ObjString* name; // NULL for the top-level script.
+    int ordinal;  // order compile() started it in, the script being 0; --decode-trace finds it by this.
+};
+
+/*
+A captured variable. While the function that declared it is still running, location points at
+its slot in vm.stack, so the closure and that function share one variable with no copying.
+When the slot goes away (the block ends or the function returns), the value is moved into
+closed and location points there instead ("closing" the upvalue).
+*/
+struct ObjUpvalue {
+    Obj obj;
+    Value* location;
+    Value closed;
+    ObjUpvalue* next; // next open upvalue, lower on the stack; see VM.openUpvalues.
+};
+
+/*
+A function together with the variables it captured.
+Only functions that capture something get one; the rest are called as bare ObjFunctions.
+The upvalue pointers are stored inline, so making a closure is a single allocation.
+*/
+typedef struct {
+    Obj obj;
+    ObjFunction* function;
+    int upvalueCount;
+    ObjUpvalue* upvalues[];
+} ObjClosure;
+
+/*
+Hidden class: the layout of an instance's fields, shared by every instance that got the same
+fields in the same order. The root shape has no fields; adding a field moves an instance to
+the child shape for that name, which is created once and then found in transitions, so the
+shapes form a tree. Field i of an instance with this shape is in its fields[i].
+*/
+struct ObjShape {
+    Obj obj;
+    ObjShape* parent;   // NULL for the root.
+    ObjString* name;    // the field this shape added to its parent; NULL for the root.
+    int fieldCount;     // this field is fields[fieldCount - 1].
+    Table transitions;  // field name -> child shape.
+};
+
+struct ObjClass {
+    Obj obj;
+    ObjString* name;
+    Table methods;
+    Value initializer; // the "init" method, looked up once when it is defined; NIL_VAL if none.
+    int fieldHint;     // most fields an instance has grown to; new instances start with room for that many.
+    uint32_t version;  // bumped whenever methods changes; method caches holding an older one are stale.
+};
+
+typedef struct {
+    Obj obj;
+    ObjClass* klass;
+    ObjShape* shape;
+    Value* fields;     // shape->fieldCount in use.
+    int fieldCapacity;
+} ObjInstance;
+
+// a method read off an instance as a value: remembers the receiver for 'this'.
+typedef struct {
+    Obj obj;
+    Value receiver;
+    Value method; // an ObjClosure or, if it captures nothing, a bare ObjFunction.
+} ObjBoundMethod;
+
+// [a, b, c]: any values, stored contiguously.
+typedef struct {
+    Obj obj;
+    ValueArray items;
+} ObjArray;
+
+/*
+An array that only holds numbers, stored as plain doubles: half the size of the Values,
+no tag checks when reading it, and the bulk natives (sum, dot, ...) run SIMD kernels on it.
+*/
+typedef struct {
+    Obj obj;
+    double* items;
+    int count;
+    int capacity;
+} ObjNumberArray;
+
+// map(): keys are numbers, strings, booleans or nil; m[key] reads and writes it.
+typedef struct {
+    Obj obj;
+    ValueTable table;
+} ObjMap;
+
+typedef struct VM VM;
+typedef struct CallFrame CallFrame;
+
+typedef enum {
+    FIBER_NEW,       // not resumed yet; it has no stack until it is.
+    FIBER_SUSPENDED, // in yield(), waiting to be resumed.
+    FIBER_RUNNING,   // the running fiber, or one waiting in resume() for the fiber it resumed.
+    FIBER_DONE,      // its function returned, or a runtime error ended it.
+} FiberState;
+
+/*
+A coroutine: a function with its own value stack and call frames, so it can stop in the
+middle (yield) and carry on later (resume) without the C stack being involved.
+The running fiber's stack, frames and open upvalues are the VM's own fields; the rest
+keep theirs here, and switching is swapping those pointers. Stacks come from the VM's
+FiberPool when a fiber first runs and go back to it when the fiber is done.
+The main script runs on a fiber too, VM.mainFiber, whose stack is the VM's big one.
+*/
+typedef struct ObjFiber {
+    Obj obj;
+    Value function;   // a closure, function or bound method, taking the first resume's value if it has a parameter.
+    FiberState state;
+    CallFrame* frames;
+    int frameCount;
+    Value* stack;
+    int stackCapacity;
+    Value* stackTop;
+    ObjUpvalue* openUpvalues;
+    struct ObjFiber* caller; // the fiber that resumed it, while it runs; yield() goes back there.
+} ObjFiber;
+
+/*
+A function written in C.
+NATIVE_VALUES takes its arguments as Values and leaves its result in args[-1], the callee's slot.
+It returns false after reporting a runtime error with runtimeError().
+The typed signatures take and return plain doubles, so C library functions like sqrt()
+can be registered as they are. The VM checks the argument count and types at the call,
+or not at all where the compiler proved the arguments numbers (OP_CALL_NUM).
+*/
+typedef bool (*NativeFn)(VM* vm, int argCount, Value* args);
+typedef double (*UnaryNativeFn)(double a);
+typedef double (*BinaryNativeFn)(double a, double b);
+
+typedef enum {
+    NATIVE_VALUES,
+    NATIVE_UNARY,  // double(double)
+    NATIVE_BINARY, // double(double, double)
+} NativeSignature;
+
+typedef struct {
+    Obj obj;
+    ObjString* name;
+    NativeSignature signature;
+    int arity; // -1 for a NATIVE_VALUES function taking any number of arguments.
+    union {
+        NativeFn values;
+        UnaryNativeFn unary;
+        BinaryNativeFn binary;
+    } as;
+} ObjNative;
+
+ObjArray* newArray(VM* vm);
+ObjBoundMethod* newBoundMethod(VM* vm, Value receiver, Value method);
+ObjClass* newClass(VM* vm, ObjString* name);
+ObjClosure* newClosure(VM* vm, ObjFunction* function);
+ObjFiber* newFiber(VM* vm, Value function);
+ObjFunction* newFunction(VM* vm);
+ObjInstance* newInstance(VM* vm, ObjClass* klass);
+ObjMap* newMap(VM* vm);
+// the caller fills in native->as for the signature.
+ObjNative* newNative(VM* vm, ObjString* name, NativeSignature signature, int arity);
+// count zeros.
+ObjNumberArray* newNumberArray(VM* vm, int count);
+ObjShape* newShape(VM* vm, ObjShape* parent, ObjString* name);
+ObjUpvalue* newUpvalue(VM* vm, Value* slot);
+
+// the string is interned in, and owned by, the given VM.
+ObjString* takeString(VM* vm, char* chars, int length);
+ObjString* copyString(VM* vm, const char* chars, int length);
+void printObject(FILE* out, Value value);
+// the text print shows for the value, as a string of the given VM.
+ObjString* valueToString(VM* vm, Value value);
 
 static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
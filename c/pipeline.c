@@ -0,0 +1,112 @@
+// pthreads are POSIX, not ISO C.
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+
+/*
+ * head: next slot the scanner thread will fill. Only the scanner writes it.
+ * tail: next slot the compiler will read. Only the compiler writes it.
+ * Both sides work in batches and only publish their index once per batch (or when they are
+ * about to wait), so the two cores don't bounce the cache line on every token.
+ * The indices grow forever and are masked into the ring, so head - tail is the number of queued tokens.
+ */
+#define TOKEN_RING_SIZE 4096 // power of two.
+#define TOKEN_RING_MASK (TOKEN_RING_SIZE - 1)
+#define TOKEN_BATCH 64
+
+struct TokenRing {
+    Token tokens[TOKEN_RING_SIZE];
+
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_bool stop; // the compiler is done; the scanner should exit even if the ring is full.
+
+    // consumer-side copies, so reading a token usually touches no shared state.
+    _Alignas(64) size_t readHead;
+    size_t readTail;
+
+    Scanner scanner; // only the scanner thread touches it.
+    pthread_t thread;
+};
+
+static void* scanAll(void* arg) {
+    TokenRing* ring = arg;
+    size_t head = 0;
+    size_t tail = 0;
+
+    for (;;) {
+        // wait for room for a whole batch.
+        while (head + TOKEN_BATCH - tail > TOKEN_RING_SIZE) {
+            if (atomic_load_explicit(&ring->stop, memory_order_relaxed)) return NULL;
+            tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            if (head + TOKEN_BATCH - tail > TOKEN_RING_SIZE) sched_yield();
+        }
+
+        bool done = false;
+        for (int i = 0; i < TOKEN_BATCH; i++) {
+            Token token = scanToken(&ring->scanner);
+            ring->tokens[head++ & TOKEN_RING_MASK] = token;
+            if (token.type == TOKEN_EOF) {
+                done = true;
+                break;
+            }
+        }
+
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+        if (done) return NULL;
+    }
+}
+
+TokenRing* startPipeline(const char* source, size_t length) {
+    // with one core the two threads would only take turns, which is slower than scanning inline.
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2) return NULL;
+
+    // sizeof is a multiple of the 64-byte alignment, as aligned_alloc requires.
+    TokenRing* ring = aligned_alloc(_Alignof(TokenRing), sizeof(TokenRing));
+    if (ring == NULL) return NULL;
+
+    initScanner(&ring->scanner, source, length);
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    atomic_store(&ring->stop, false);
+    ring->readHead = 0;
+    ring->readTail = 0;
+
+    if (pthread_create(&ring->thread, NULL, scanAll, ring) != 0) {
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+Token pipelineToken(TokenRing* ring) {
+    if (ring->readTail == ring->readHead) {
+        // let the scanner reuse everything consumed so far before waiting on it.
+        atomic_store_explicit(&ring->tail, ring->readTail, memory_order_release);
+        while ((ring->readHead = atomic_load_explicit(&ring->head, memory_order_acquire)) == ring->readTail) {
+            sched_yield();
+        }
+    }
+
+    Token token = ring->tokens[ring->readTail & TOKEN_RING_MASK];
+    // the scanner has exited after EOF, so keep handing it out the way scanToken() does.
+    if (token.type == TOKEN_EOF) return token;
+
+    ring->readTail++;
+    if ((ring->readTail & (TOKEN_BATCH - 1)) == 0) {
+        atomic_store_explicit(&ring->tail, ring->readTail, memory_order_release);
+    }
+    return token;
+}
+
+void stopPipeline(TokenRing* ring) {
+    atomic_store_explicit(&ring->stop, true, memory_order_relaxed);
+    pthread_join(ring->thread, NULL);
+    free(ring);
+}
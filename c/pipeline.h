@@ -0,0 +1,24 @@
+#ifndef clox_pipeline_h
+#define clox_pipeline_h
+
+#include "common.h"
+#include "scanner.h"
+
+/*
+ * Pipelined front end: a scanner thread fills a single-producer/single-consumer ring of tokens
+ * while the compiler consumes them, so lexing and parsing run on two cores.
+ * Starting a thread costs more than scanning a small script, so only sources
+ * of at least PIPELINE_MIN_SOURCE bytes on a multi-core host take this path.
+ * Each compile gets its own ring and thread.
+ */
+#define PIPELINE_MIN_SOURCE (256 * 1024)
+
+typedef struct TokenRing TokenRing;
+
+// NULL if the thread could not (or should not) be started; scan inline instead.
+TokenRing* startPipeline(const char* source, size_t length);
+Token pipelineToken(TokenRing* ring);
+// joins the thread and frees the ring.
+void stopPipeline(TokenRing* ring);
+
+#endif
@@ -0,0 +1,160 @@
+// clock_gettime() is POSIX, not ISO C.
+#define _POSIX_C_SOURCE 200809L
+
+#include "common.h"
+
+#ifdef PROFILE_OPCODES
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "debug.h"
+#include "profile.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIME_UNIT "cycles"
+static uint64_t now() {
+    return __rdtsc();
+}
+#else
+#define TIME_UNIT "ns"
+static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+#define TOP_PAIRS 20
+
+typedef struct {
+    uint64_t counts[UINT8_COUNT];
+    uint64_t time[UINT8_COUNT];
+    uint64_t pairs[UINT8_COUNT][UINT8_COUNT];
+
+    int previous;       // opcode dispatched last, or -1 at the start of a run.
+    uint64_t started;   // when it was dispatched.
+} Profile;
+
+static Profile profile;
+
+void profileStart() {
+    profile.previous = -1;
+}
+
+void profileInstruction(uint8_t instruction) {
+    uint64_t time = now();
+    if (profile.previous != -1) {
+        profile.time[profile.previous] += time - profile.started;
+        profile.pairs[profile.previous][instruction]++;
+    }
+    profile.counts[instruction]++;
+
+    profile.previous = instruction;
+    profile.started = time;
+}
+
+typedef struct {
+    int first;
+    int second;
+    uint64_t count;
+} Pair;
+
+static int compareOpcodes(const void* a, const void* b) {
+    uint64_t countA = profile.counts[*(const int*)a];
+    uint64_t countB = profile.counts[*(const int*)b];
+    return countA < countB ? 1 : countA > countB ? -1 : 0;
+}
+
+static int comparePairs(const void* a, const void* b) {
+    uint64_t countA = ((const Pair*)a)->count;
+    uint64_t countB = ((const Pair*)b)->count;
+    return countA < countB ? 1 : countA > countB ? -1 : 0;
+}
+
+// opcodes that ran, most frequent first. Returns how many there are.
+static int sortedOpcodes(int* opcodes) {
+    int count = 0;
+    for (int i = 0; i < UINT8_COUNT; i++) {
+        if (profile.counts[i] > 0) opcodes[count++] = i;
+    }
+    qsort(opcodes, count, sizeof(int), compareOpcodes);
+    return count;
+}
+
+// every pair that ran, most frequent first. The caller frees the array.
+static Pair* sortedPairs(int* count) {
+    *count = 0;
+    for (int i = 0; i < UINT8_COUNT; i++) {
+        for (int j = 0; j < UINT8_COUNT; j++) {
+            if (profile.pairs[i][j] > 0) (*count)++;
+        }
+    }
+
+    Pair* pairs = malloc(sizeof(Pair) * (*count > 0 ? *count : 1));
+    int n = 0;
+    for (int i = 0; i < UINT8_COUNT; i++) {
+        for (int j = 0; j < UINT8_COUNT; j++) {
+            if (profile.pairs[i][j] > 0) pairs[n++] = (Pair){i, j, profile.pairs[i][j]};
+        }
+    }
+    qsort(pairs, n, sizeof(Pair), comparePairs);
+    return pairs;
+}
+
+static void writeJson(const char* path, int* opcodes, int opcodeCount, Pair* pairs, int pairCount) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not write profile \"%s\".\n", path);
+        return;
+    }
+
+    fprintf(file, "{\n  \"unit\": \"%s\",\n  \"opcodes\": [", TIME_UNIT);
+    for (int i = 0; i < opcodeCount; i++) {
+        int op = opcodes[i];
+        fprintf(file, "%s\n    {\"name\": \"%s\", \"count\": %llu, \"time\": %llu}",
+                i == 0 ? "" : ",", opcodeName((uint8_t)op),
+                (unsigned long long)profile.counts[op], (unsigned long long)profile.time[op]);
+    }
+    fprintf(file, "\n  ],\n  \"pairs\": [");
+    for (int i = 0; i < pairCount; i++) {
+        fprintf(file, "%s\n    {\"first\": \"%s\", \"second\": \"%s\", \"count\": %llu}",
+                i == 0 ? "" : ",", opcodeName((uint8_t)pairs[i].first),
+                opcodeName((uint8_t)pairs[i].second), (unsigned long long)pairs[i].count);
+    }
+    fprintf(file, "\n  ]\n}\n");
+    fclose(file);
+}
+
+void profileReport() {
+    int opcodes[UINT8_COUNT];
+    int opcodeCount = sortedOpcodes(opcodes);
+    int pairCount;
+    Pair* pairs = sortedPairs(&pairCount);
+
+    uint64_t total = 0;
+    for (int i = 0; i < opcodeCount; i++) total += profile.counts[opcodes[i]];
+
+    fprintf(stderr, "== opcode profile ==\n");
+    fprintf(stderr, "%-20s %14s %7s %16s %10s\n", "opcode", "count", "%", TIME_UNIT, "per op");
+    for (int i = 0; i < opcodeCount; i++) {
+        int op = opcodes[i];
+        fprintf(stderr, "%-20s %14llu %6.2f%% %16llu %10.1f\n", opcodeName((uint8_t)op),
+                (unsigned long long)profile.counts[op], 100.0 * profile.counts[op] / total,
+                (unsigned long long)profile.time[op], (double)profile.time[op] / profile.counts[op]);
+    }
+
+    fprintf(stderr, "\n== top opcode pairs ==\n");
+    for (int i = 0; i < pairCount && i < TOP_PAIRS; i++) {
+        fprintf(stderr, "%-20s -> %-20s %14llu\n", opcodeName((uint8_t)pairs[i].first),
+                opcodeName((uint8_t)pairs[i].second), (unsigned long long)pairs[i].count);
+    }
+
+    const char* path = getenv("CLOX_PROFILE");
+    writeJson(path != NULL ? path : PROFILE_JSON_PATH, opcodes, opcodeCount, pairs, pairCount);
+    free(pairs);
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef clox_profile_h
+#define clox_profile_h
+
+#include "common.h"
+
+/*
+ * Opcode profiler, compiled in only with PROFILE_OPCODES (common.h).
+ * run() calls profileInstruction() before dispatching every instruction; it counts each opcode
+ * and each (previous, current) opcode pair, and charges the time since the previous dispatch
+ * to the previous opcode. Time is in TSC cycles on x86 and nanoseconds elsewhere.
+ * The counters are process-wide, so profile one VM on one thread at a time.
+ */
+#ifdef PROFILE_OPCODES
+
+#define PROFILE_JSON_PATH "clox-profile.json" // overridden by the CLOX_PROFILE environment variable.
+
+void profileStart();
+void profileInstruction(uint8_t instruction);
+void profileReport();
+
+#endif
+
+#endif
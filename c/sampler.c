@@ -0,0 +1,304 @@
+// sigaction() and setitimer() are POSIX, not ISO C.
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "memory.h"
+#include "sampler.h"
+#include "vm.h"
+
+typedef struct {
+    int line;
+    long samples;
+} LineSamples;
+
+// one call on the sampled stack: the function and the offset of its current opcode.
+// A NULL function stands for the calls cut from the middle of a deep stack.
+typedef struct {
+    ObjFunction* function;
+    int32_t offset;
+} SampleFrame;
+
+// where the interpreter was: its calls, outermost first, are sampleFrames[firstFrame, firstFrame + depth).
+typedef struct {
+    int32_t firstFrame;
+    int32_t depth;
+} Sample;
+
+// a folded stack ("script;fn;fn:line") and how many samples landed on it.
+typedef struct {
+    char* stack;
+    long samples;
+} StackSamples;
+
+/*
+ * The handler is the only writer of samples[], sampleFrames[] and their counts, and it runs
+ * on the interpreter's own thread, so the buffers need no lock: the VM only reads them
+ * after clearing sampledVM, when no new sample can land.
+ * The buffers run to tens of megabytes, so they exist only between startSampling() and samplingReport().
+ */
+static Sample* samples = NULL;
+static SampleFrame* sampleFrames = NULL;
+static volatile sig_atomic_t sampleCount = 0;
+static volatile sig_atomic_t sampleFrameCount = 0;
+static volatile sig_atomic_t droppedSamples = 0;
+static VM* volatile sampledVM = NULL; // VM inside run(), or NULL outside run().
+
+static bool sampling = false;
+static const char* sampledScript;
+static long* lineSamples = NULL; // samples per source line, indexed by line number.
+static int lineCapacity = 0;
+static long totalSamples = 0;
+static StackSamples* stacks = NULL; // every run's folded stacks; samplingReport() merges repeats.
+static int stackCount = 0;
+static int stackCapacity = 0;
+
+static void onSample(int signal) {
+    (void)signal;
+    VM* vm = sampledVM;
+    if (vm == NULL) return;
+
+    int running = vm->frameCount; // read once: the count and the frames read below must agree.
+    if (running == 0) return;
+    // pairs with the release in call(): every frame below the count read next is complete.
+    atomic_signal_fence(memory_order_acquire);
+
+    // the running fiber's calls sit on top of those of the fibers that resumed it, back to the script.
+    // the running fiber's own count is live in the VM; the waiting ones saved theirs when they resumed.
+    int total = running;
+    for (ObjFiber* fiber = vm->fiber->caller; fiber != NULL; fiber = fiber->caller) {
+        total += fiber->frameCount;
+    }
+    bool cut = total > 2 * SAMPLE_EDGE_FRAMES;
+    int depth = cut ? 2 * SAMPLE_EDGE_FRAMES + 1 : total;
+    if (sampleCount == SAMPLE_MAX || sampleFrameCount + depth > SAMPLE_FRAMES_MAX) {
+        droppedSamples++;
+        return;
+    }
+
+    // walked innermost first; position is where a call stands in the whole stack, outermost first.
+    SampleFrame* out = &sampleFrames[sampleFrameCount];
+    if (cut) out[SAMPLE_EDGE_FRAMES].function = NULL;
+    int position = total - 1;
+    CallFrame* frames = vm->frames;
+    int frameCount = running;
+    for (ObjFiber* fiber = vm->fiber; fiber != NULL; fiber = fiber->caller) {
+        for (int i = frameCount - 1; i >= 0; i--, position--) {
+            int slot = position;
+            if (cut && position >= SAMPLE_EDGE_FRAMES) {
+                if (position < total - SAMPLE_EDGE_FRAMES) continue;
+                slot = position - (total - depth);
+            }
+            // ip already points past the opcode being executed (in a caller, past the call).
+            CallFrame* frame = &frames[i];
+            out[slot].function = frame->function;
+            out[slot].offset = (int32_t)(frame->ip - frame->function->chunk.code) - 1;
+        }
+        if (fiber->caller != NULL) {
+            frames = fiber->caller->frames;
+            frameCount = fiber->caller->frameCount;
+        }
+    }
+
+    Sample* sample = &samples[sampleCount];
+    sample->firstFrame = sampleFrameCount;
+    sample->depth = depth;
+    sampleFrameCount += depth;
+    sampleCount++;
+}
+
+void startSampling(const char* scriptName) {
+    sampling = true;
+    sampledScript = scriptName;
+    samples = ALLOCATE(Sample, SAMPLE_MAX);
+    sampleFrames = ALLOCATE(SampleFrame, SAMPLE_FRAMES_MAX);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = SAMPLE_INTERVAL_US;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void beginSampledRun(VM* vm) {
+    if (!sampling) return;
+    sampleCount = 0;
+    sampleFrameCount = 0;
+    sampledVM = vm;
+}
+
+static int sampleLine(const SampleFrame* frame) {
+    Chunk* chunk = &frame->function->chunk;
+    int offset = frame->offset;
+    if (offset < 0) offset = 0;
+    if (offset >= chunk->count) return -1;
+    return chunk->lines[offset];
+}
+
+// appends one frame's name to a folded stack; the top-level code goes by the script's path.
+static void appendFrame(char** buffer, int* length, int* capacity, const SampleFrame* frame) {
+    const char* chars;
+    if (frame->function == NULL) {
+        chars = "...";
+    } else {
+        ObjString* name = frame->function->name;
+        chars = name == NULL ? sampledScript : name->chars;
+    }
+    int nameLength = (int)strlen(chars);
+    // the name, a ';' or ':', a line number and the terminator.
+    int needed = *length + nameLength + 16;
+    if (needed > *capacity) {
+        int oldCapacity = *capacity;
+        while (*capacity < needed) *capacity = GROW_CAPACITY(*capacity);
+        *buffer = GROW_ARRAY(char, *buffer, oldCapacity, *capacity);
+    }
+    if (*length > 0) (*buffer)[(*length)++] = ';';
+    memcpy(*buffer + *length, chars, nameLength);
+    *length += nameLength;
+}
+
+static void addStack(const char* chars, int length) {
+    if (stackCount == stackCapacity) {
+        int oldCapacity = stackCapacity;
+        stackCapacity = GROW_CAPACITY(oldCapacity);
+        stacks = GROW_ARRAY(StackSamples, stacks, oldCapacity, stackCapacity);
+    }
+    char* stack = ALLOCATE(char, length + 1);
+    memcpy(stack, chars, length);
+    stack[length] = '\0';
+    stacks[stackCount++] = (StackSamples){stack, 1};
+}
+
+static int compareStacks(const void* a, const void* b) {
+    return strcmp(((const StackSamples*)a)->stack, ((const StackSamples*)b)->stack);
+}
+
+// sorts the folded stacks and adds up the samples of equal ones, which end up side by side.
+static void mergeStacks() {
+    qsort(stacks, stackCount, sizeof(StackSamples), compareStacks);
+    int merged = 0;
+    for (int i = 0; i < stackCount; i++) {
+        if (merged > 0 && strcmp(stacks[merged - 1].stack, stacks[i].stack) == 0) {
+            stacks[merged - 1].samples += stacks[i].samples;
+            FREE_ARRAY(char, stacks[i].stack, strlen(stacks[i].stack) + 1);
+        } else {
+            stacks[merged++] = stacks[i];
+        }
+    }
+    stackCount = merged;
+}
+
+/*
+ * fold the raw offsets into per-line counts and folded stacks while the functions (and their
+ * names and line tables) still exist. Only the innermost call gets a line: a flame graph
+ * then has one box per function, split by line at the top.
+ */
+void endSampledRun(VM* vm) {
+    if (!sampling) return;
+    sampledVM = NULL;
+
+    char* buffer = NULL;
+    int capacity = 0;
+    for (int i = 0; i < sampleCount; i++) {
+        const SampleFrame* frames = &sampleFrames[samples[i].firstFrame];
+        int depth = samples[i].depth;
+        int line = sampleLine(&frames[depth - 1]);
+        if (line < 0) continue;
+
+        if (line >= lineCapacity) {
+            int oldCapacity = lineCapacity;
+            while (lineCapacity <= line) lineCapacity = GROW_CAPACITY(lineCapacity);
+            lineSamples = GROW_ARRAY(long, lineSamples, oldCapacity, lineCapacity);
+            memset(lineSamples + oldCapacity, 0, sizeof(long) * (lineCapacity - oldCapacity));
+        }
+        lineSamples[line]++;
+        totalSamples++;
+
+        int length = 0;
+        for (int frame = 0; frame < depth; frame++) {
+            appendFrame(&buffer, &length, &capacity, &frames[frame]);
+        }
+        length += sprintf(buffer + length, ":%d", line);
+        addStack(buffer, length);
+    }
+    FREE_ARRAY(char, buffer, capacity);
+    sampleCount = 0;
+    sampleFrameCount = 0;
+    mergeStacks(); // a hot loop repeats the same few stacks thousands of times.
+}
+
+static int compareLines(const void* a, const void* b) {
+    long samplesA = ((const LineSamples*)a)->samples;
+    long samplesB = ((const LineSamples*)b)->samples;
+    if (samplesA != samplesB) return samplesA < samplesB ? 1 : -1;
+    return ((const LineSamples*)a)->line - ((const LineSamples*)b)->line;
+}
+
+void samplingReport() {
+    if (!sampling) return;
+
+    struct itimerval off;
+    memset(&off, 0, sizeof(off));
+    setitimer(ITIMER_PROF, &off, NULL);
+
+    int lineCount = 0;
+    LineSamples* lines = malloc(sizeof(LineSamples) * (lineCapacity > 0 ? lineCapacity : 1));
+    for (int line = 0; line < lineCapacity; line++) {
+        if (lineSamples[line] > 0) lines[lineCount++] = (LineSamples){line, lineSamples[line]};
+    }
+    qsort(lines, lineCount, sizeof(LineSamples), compareLines);
+
+    fprintf(stderr, "== line profile: %ld samples, %d us interval ==\n",
+            totalSamples, SAMPLE_INTERVAL_US);
+    if (droppedSamples > 0) {
+        fprintf(stderr, "(%ld samples dropped, buffer full)\n", (long)droppedSamples);
+    }
+    fprintf(stderr, "%8s %10s %7s\n", "line", "samples", "%");
+    for (int i = 0; i < lineCount; i++) {
+        fprintf(stderr, "%8d %10ld %6.2f%%\n", lines[i].line, lines[i].samples,
+                100.0 * lines[i].samples / totalSamples);
+    }
+
+    const char* path = getenv("CLOX_SAMPLES");
+    if (path == NULL) path = SAMPLE_FOLDED_PATH;
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not write samples \"%s\".\n", path);
+    } else {
+        // one "stack count" line per distinct stack: <script>;<function>;...;<function>:<line> <samples>
+        mergeStacks();
+        for (int i = 0; i < stackCount; i++) {
+            fprintf(file, "%s %ld\n", stacks[i].stack, stacks[i].samples);
+        }
+        fclose(file);
+    }
+
+    free(lines);
+    for (int i = 0; i < stackCount; i++) {
+        FREE_ARRAY(char, stacks[i].stack, strlen(stacks[i].stack) + 1);
+    }
+    FREE_ARRAY(StackSamples, stacks, stackCapacity);
+    stacks = NULL;
+    stackCount = 0;
+    stackCapacity = 0;
+    FREE_ARRAY(long, lineSamples, lineCapacity);
+    lineSamples = NULL;
+    lineCapacity = 0;
+    FREE_ARRAY(Sample, samples, SAMPLE_MAX);
+    samples = NULL;
+    FREE_ARRAY(SampleFrame, sampleFrames, SAMPLE_FRAMES_MAX);
+    sampleFrames = NULL;
+    sampling = false;
+}
@@ -0,0 +1,30 @@
+#ifndef clox_sampler_h
+#define clox_sampler_h
+
+#include "chunk.h"
+#include "common.h"
+#include "vm.h"
+
+/*
+ * Statistical line profiler (clox --profile-lines).
+ * An ITIMER_PROF timer delivers SIGPROF every SAMPLE_INTERVAL_US of CPU time, and the handler
+ * copies the running VM's call frames: each function and the bytecode offset of its ip. run() itself does
+ * nothing extra per instruction. Samples are mapped to names and source lines through each function's chunk
+ * once the run finishes,
+ * and reported at exit as a flat line profile (stderr) and a folded-stack file for flamegraph tools,
+ * one "<script>;<function>;...;<function>:<line> <samples>" line per distinct stack.
+ * A sample taken inside a fiber also holds the calls of the fibers that resumed it. A stack deeper
+ * than 2 * SAMPLE_EDGE_FRAMES keeps that many calls at each end, with a "..." frame in between.
+ */
+#define SAMPLE_INTERVAL_US 1000
+#define SAMPLE_MAX (1 << 20)
+#define SAMPLE_FRAMES_MAX (1 << 22) // call frames kept across all of a run's samples.
+#define SAMPLE_EDGE_FRAMES 32 // calls kept at each end of a deeper stack.
+#define SAMPLE_FOLDED_PATH "clox-lines.folded" // overridden by the CLOX_SAMPLES environment variable.
+
+void startSampling(const char* scriptName);
+void beginSampledRun(VM* vm);
+void endSampledRun(VM* vm);
+void samplingReport();
+
+#endif
@@ -4,80 +4,170 @@
 #include "common.h"
 #include "scanner.h"
 
-//
 /*
- * Scanner chews through the users source code, it tracks how far it's gone.
- * start: pointer marks the beginning of the current lexeme being scanned.
- * current: pointer marks the character currently being looked at.
- * */
-typedef struct {
-    const char* start;
-    const char* current;
-    int line;
-} Scanner;
+ * Vectorized fast paths for the long runs in a source file: indentation, comment bodies,
+ * identifiers, digits and string contents. A block of 16 (SSE2) or 32 (AVX2, build with -mavx2)
+ * bytes is classified at once and the scanner jumps to the first byte that ends the run.
+ * Without either instruction set skipSpan() does nothing and the scalar loops below do all the work.
+ */
+#if defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#define SCANNER_SIMD
+#define SIMD_WIDTH 32
+#define SIMD_FULL_MASK 0xffffffffu
+typedef __m256i Block;
+#define LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define SPLAT(c) _mm256_set1_epi8((char)(c))
+#define EQ(a, b) _mm256_cmpeq_epi8(a, b)
+#define OR(a, b) _mm256_or_si256(a, b)
+#define SUB(a, b) _mm256_sub_epi8(a, b)
+#define MIN_U8(a, b) _mm256_min_epu8(a, b)
+#define MOVEMASK(v) ((uint32_t)_mm256_movemask_epi8(v))
+#elif defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define SCANNER_SIMD
+#define SIMD_WIDTH 16
+#define SIMD_FULL_MASK 0xffffu
+typedef __m128i Block;
+#define LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define SPLAT(c) _mm_set1_epi8((char)(c))
+#define EQ(a, b) _mm_cmpeq_epi8(a, b)
+#define OR(a, b) _mm_or_si128(a, b)
+#define SUB(a, b) _mm_sub_epi8(a, b)
+#define MIN_U8(a, b) _mm_min_epu8(a, b)
+#define MOVEMASK(v) ((uint32_t)_mm_movemask_epi8(v))
+#endif
 
-
-Scanner scanner;
-
-void initScanner(const char* source) {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+void initScanner(Scanner* scanner, const char* source, size_t length) {
+    scanner->start = source;
+    scanner->current = source;
+    scanner->end = source + length;
+    scanner->line = 1;
+    scanner->interpolations = 0;
 }
 
-static bool isAtEnd() {
-    return *scanner.current == '\0';
+static bool isAtEnd(Scanner* scanner) {
+    return scanner->current >= scanner->end;
 }
 
-static Token makeToken(TokenType type) {
+static Token makeToken(Scanner* scanner, TokenType type) {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (int)(scanner->current - scanner->start);
+    token.line = scanner->line;
     return token;
 }
 
-static Token errorToken(const char* message) {
+static Token errorToken(Scanner* scanner, const char* message) {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = message;
     token.length = (int)strlen(message);
-    token.line = scanner.line;
+    token.line = scanner->line;
     return token;
 }
 
-static char advance() {
-    scanner.current++;
-    return scanner.current[-1];
+static char advance(Scanner* scanner) {
+    scanner->current++;
+    return scanner->current[-1];
+}
+
+static char peek(Scanner* scanner) {
+    if (isAtEnd(scanner)) return '\0';
+    return *scanner->current;
+}
+
+static char peekNext(Scanner* scanner) {
+    if (scanner->end - scanner->current < 2) return '\0';
+    return scanner->current[1];
+}
+
+typedef enum {
+    SPAN_WHITESPACE,  // ' ', '\r', '\t', '\n'
+    SPAN_COMMENT,     // anything up to the next '\n'
+    SPAN_IDENTIFIER,  // [A-Za-z0-9_]
+    SPAN_DIGITS,      // [0-9]
+    SPAN_STRING,      // anything up to the closing '"' or a '$'
+} Span;
+
+#ifdef SCANNER_SIMD
+// lo <= c <= hi for every byte, as an unsigned compare: (c - lo) == min(c - lo, hi - lo).
+static Block inRange(Block block, char lo, char hi) {
+    Block shifted = SUB(block, SPLAT(lo));
+    return EQ(MIN_U8(shifted, SPLAT(hi - lo)), shifted);
 }
 
-static char peek() {
-    return *scanner.current;
+// one bit per byte of the block that continues the span.
+static uint32_t spanMask(Block block, Span span) {
+    switch (span) {
+        case SPAN_WHITESPACE:
+            return MOVEMASK(OR(OR(EQ(block, SPLAT(' ')), EQ(block, SPLAT('\t'))),
+                               OR(EQ(block, SPLAT('\r')), EQ(block, SPLAT('\n')))));
+        case SPAN_COMMENT:
+            return ~MOVEMASK(EQ(block, SPLAT('\n'))) & SIMD_FULL_MASK;
+        case SPAN_IDENTIFIER: {
+            // setting bit 0x20 folds 'A'-'Z' onto 'a'-'z' without pulling any other byte into that range.
+            Block letters = inRange(OR(block, SPLAT(0x20)), 'a', 'z');
+            return MOVEMASK(OR(OR(letters, inRange(block, '0', '9')), EQ(block, SPLAT('_'))));
+        }
+        case SPAN_DIGITS:
+            return MOVEMASK(inRange(block, '0', '9'));
+        case SPAN_STRING:
+            return ~MOVEMASK(OR(EQ(block, SPLAT('"')), EQ(block, SPLAT('$')))) & SIMD_FULL_MASK;
+    }
+    return 0;
 }
+#endif
+
+/*
+ * Consume whole blocks of the given span while at least one full block is left in the source.
+ * Whatever is left (the byte that ends the span, or a tail shorter than a block)
+ * is handled by the caller's scalar loop, so the result is the same with or without SIMD.
+ * Newlines inside whitespace and strings are counted so that scanner->line stays exact.
+ */
+static void skipSpan(Scanner* scanner, Span span) {
+#ifdef SCANNER_SIMD
+    bool countLines = span == SPAN_WHITESPACE || span == SPAN_STRING;
+    while (scanner->end - scanner->current >= SIMD_WIDTH) {
+        Block block = LOAD(scanner->current);
+        uint32_t stop = ~spanMask(block, span) & SIMD_FULL_MASK;
+        int taken = stop == 0 ? SIMD_WIDTH : __builtin_ctz(stop);
+
+        if (countLines && taken > 0) {
+            uint32_t newlines = MOVEMASK(EQ(block, SPLAT('\n')));
+            if (taken < SIMD_WIDTH) newlines &= (1u << taken) - 1;
+            scanner->line += __builtin_popcount(newlines);
+        }
 
-static char peekNext() {
-    if (isAtEnd()) return '\0';
-    return scanner.current[1];
+        scanner->current += taken;
+        if (stop != 0) return;
+    }
+#else
+    (void)span;
+#endif
 }
 
-static void skipWhitespace() {
+static void skipWhitespace(Scanner* scanner) {
     for (;;) {
-        char c = peek();
+        char c = peek(scanner);
         switch (c) {
             case ' ':
             case '\r':
             case '\t':
-                advance();
+                advance(scanner);
+                skipSpan(scanner, SPAN_WHITESPACE);
                 break;
             case '\n':
-                scanner.line++;
-                advance();
+                scanner->line++;
+                advance(scanner);
+                skipSpan(scanner, SPAN_WHITESPACE);
                 break;
             case '/':
-                if (peekNext() == '/') {
+                if (peekNext(scanner) == '/') {
                     // A comment goes until the end of the line.
-                    while (peek() != '\n' && !isAtEnd()) advance();
+                    skipSpan(scanner, SPAN_COMMENT);
+                    while (peek(scanner) != '\n' && !isAtEnd(scanner)) advance(scanner);
                 } else {
                     return;
                 }
@@ -88,7 +178,7 @@ static void skipWhitespace() {
     }
 }
 
-static TokenType checkKeyword(int start, int length, const char* rest, TokenType type) {
+static TokenType checkKeyword(Scanner* scanner, int start, int length, const char* rest, TokenType type) {
     /*
      * memcmp: ptr1과 ptr2가 가리키는 메모리 영역을 num 바이트만큼 비교하고, 두 영역이 동일하면 0을 반환.
         @param ptr1: 비교할 첫 번째 메모리 영역의 포인터.
@@ -96,48 +186,68 @@ static TokenType checkKeyword(int start, int length, const char* rest, TokenType
         @param num: 비교할 바이트 수.
         ptr1이 ptr2보다 작은 값이면 음수를, ptr1이 ptr2보다 큰 값이면 양수를 반환.
      */
-    if (scanner.current - scanner.start == start + length &&
-        memcmp(scanner.start + start, rest, length) == 0) {
+    if (scanner->current - scanner->start == start + length &&
+        memcmp(scanner->start + start, rest, length) == 0) {
         return type;
     }
 
     return TOKEN_IDENTIFIER;
 }
 
-static bool match(char expected) {
-    if (isAtEnd()) return false;
-    if (*scanner.current != expected) return false;
-    scanner.current++;
+static bool match(Scanner* scanner, char expected) {
+    if (isAtEnd(scanner)) return false;
+    if (*scanner->current != expected) return false;
+    scanner->current++;
     return true;
 }
 
-static Token string() {
-    while (peek() != '"' && !isAtEnd()) {
-        if (peek() == '\n') scanner.line++;
-        advance();
-    }
+/*
+Scans string contents, after the opening '"' or after the '}' that ends an interpolated
+expression, up to the closing '"' (TOKEN_STRING) or the next "${" (TOKEN_INTERPOLATION).
+*/
+static Token string(Scanner* scanner) {
+    for (;;) {
+        skipSpan(scanner, SPAN_STRING);
+        while (peek(scanner) != '"' && peek(scanner) != '$' && !isAtEnd(scanner)) {
+            if (peek(scanner) == '\n') scanner->line++;
+            advance(scanner);
+        }
 
-    if (isAtEnd()) return errorToken("Unterminated string.");
+        if (isAtEnd(scanner)) return errorToken(scanner, "Unterminated string.");
+        if (peek(scanner) == '"') break;
+
+        advance(scanner); // '$'
+        if (peek(scanner) == '{') {
+            if (scanner->interpolations == INTERPOLATION_MAX) {
+                return errorToken(scanner, "Interpolation nested too deeply.");
+            }
+            advance(scanner);
+            scanner->braces[scanner->interpolations++] = 0;
+            return makeToken(scanner, TOKEN_INTERPOLATION);
+        }
+    }
 
     // the closing quote.
-    advance();
-    return makeToken(TOKEN_STRING);
+    advance(scanner);
+    return makeToken(scanner, TOKEN_STRING);
 }
 
 static bool isDigit(char c) {
     return c >= '0' && c <= '9';
 }
 
-static Token number() {
-    while (isDigit(peek())) advance();
+static Token number(Scanner* scanner) {
+    skipSpan(scanner, SPAN_DIGITS);
+    while (isDigit(peek(scanner))) advance(scanner);
 
     // Look for a fractional part.
-    if (peek() == '.' && isDigit(peekNext())) {
+    if (peek(scanner) == '.' && isDigit(peekNext(scanner))) {
         // Consume the "."
-        advance();
-        while (isDigit(peek())) advance();
+        advance(scanner);
+        skipSpan(scanner, SPAN_DIGITS);
+        while (isDigit(peek(scanner))) advance(scanner);
     }
-    return makeToken(TOKEN_NUMBER);
+    return makeToken(scanner, TOKEN_NUMBER);
 }
 
 static bool isAlpha(char c) {
@@ -146,76 +256,105 @@ static bool isAlpha(char c) {
            c == '_';
 }
 
-static TokenType identifierType() {
-    switch (scanner.start[0]) {
-        case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-        case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-        case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
+static TokenType identifierType(Scanner* scanner) {
+    switch (scanner->start[0]) {
+        case 'a': return checkKeyword(scanner, 1, 2, "nd", TOKEN_AND);
+        case 'c':
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'a': return checkKeyword(scanner, 2, 2, "se", TOKEN_CASE);
+                    case 'l': return checkKeyword(scanner, 2, 3, "ass", TOKEN_CLASS);
+                }
+            }
+            break;
+        case 'd': return checkKeyword(scanner, 1, 6, "efault", TOKEN_DEFAULT);
+        case 'e': return checkKeyword(scanner, 1, 3, "lse", TOKEN_ELSE);
         case 'f':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-                    case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-                    case 'u': return checkKeyword(2, 1, "n", TOKEN_FUN);
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'a': return checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE);
+                    case 'o': return checkKeyword(scanner, 2, 1, "r", TOKEN_FOR);
+                    case 'u': return checkKeyword(scanner, 2, 1, "n", TOKEN_FUN);
+                }
+            }
+            break;
+        case 'i': return checkKeyword(scanner, 1, 1, "f", TOKEN_IF);
+        case 'n': return checkKeyword(scanner, 1, 2, "il", TOKEN_NIL);
+        case 'o': return checkKeyword(scanner, 1, 1, "r", TOKEN_OR);
+        case 'p': return checkKeyword(scanner, 1, 4, "rint", TOKEN_PRINT);
+        case 'r': return checkKeyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
+        case 's':
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'u': return checkKeyword(scanner, 2, 3, "per", TOKEN_SUPER);
+                    case 'w': return checkKeyword(scanner, 2, 4, "itch", TOKEN_SWITCH);
                 }
             }
             break;
-        case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-        case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-        case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-        case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-        case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
         case 't':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-                    case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'h': return checkKeyword(scanner, 2, 2, "is", TOKEN_THIS);
+                    case 'r': return checkKeyword(scanner, 2, 2, "ue", TOKEN_TRUE);
                 }
             }
             break;
-        case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-        case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+        case 'v': return checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR);
+        case 'w': return checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE);
     }
     return TOKEN_IDENTIFIER;
 }
 
-static Token identifier() {
-    while (isAlpha(peek()) || isDigit(peek())) advance();
-    return makeToken(identifierType());
+static Token identifier(Scanner* scanner) {
+    skipSpan(scanner, SPAN_IDENTIFIER);
+    while (isAlpha(peek(scanner)) || isDigit(peek(scanner))) advance(scanner);
+    return makeToken(scanner, identifierType(scanner));
 }
 
-Token scanToken() {
-    skipWhitespace();
-    scanner.start = scanner.current;
-    if (isAtEnd()) return makeToken(TOKEN_EOF);
+Token scanToken(Scanner* scanner) {
+    skipWhitespace(scanner);
+    scanner->start = scanner->current;
+    if (isAtEnd(scanner)) return makeToken(scanner, TOKEN_EOF);
 
-    char c = advance();
-    if (isAlpha(c)) return identifier();
-    if (isDigit(c)) return number();
+    char c = advance(scanner);
+    if (isAlpha(c)) return identifier(scanner);
+    if (isDigit(c)) return number(scanner);
 
     switch (c) {
-        case '(': return makeToken(TOKEN_LEFT_PAREN);
-        case ')': return makeToken(TOKEN_RIGHT_PAREN);
-        case '{': return makeToken(TOKEN_LEFT_BRACE);
-        case '}': return makeToken(TOKEN_RIGHT_BRACE);
-        case ';': return makeToken(TOKEN_SEMICOLON);
-        case ',': return makeToken(TOKEN_COMMA);
-        case '.': return makeToken(TOKEN_DOT);
-        case '-': return makeToken(TOKEN_MINUS);
-        case '+': return makeToken(TOKEN_PLUS);
-        case '/': return makeToken(TOKEN_SLASH);
-        case '*': return makeToken(TOKEN_STAR);
+        case '(': return makeToken(scanner, TOKEN_LEFT_PAREN);
+        case ')': return makeToken(scanner, TOKEN_RIGHT_PAREN);
+        case '{':
+            if (scanner->interpolations > 0) scanner->braces[scanner->interpolations - 1]++;
+            return makeToken(scanner, TOKEN_LEFT_BRACE);
+        case '}':
+            if (scanner->interpolations > 0) {
+                if (scanner->braces[scanner->interpolations - 1] == 0) {
+                    scanner->interpolations--;
+                    return string(scanner);
+                }
+                scanner->braces[scanner->interpolations - 1]--;
+            }
+            return makeToken(scanner, TOKEN_RIGHT_BRACE);
+        case '[': return makeToken(scanner, TOKEN_LEFT_BRACKET);
+        case ']': return makeToken(scanner, TOKEN_RIGHT_BRACKET);
+        case ':': return makeToken(scanner, TOKEN_COLON);
+        case ';': return makeToken(scanner, TOKEN_SEMICOLON);
+        case ',': return makeToken(scanner, TOKEN_COMMA);
+        case '.': return makeToken(scanner, TOKEN_DOT);
+        case '-': return makeToken(scanner, TOKEN_MINUS);
+        case '+': return makeToken(scanner, TOKEN_PLUS);
+        case '/': return makeToken(scanner, TOKEN_SLASH);
+        case '*': return makeToken(scanner, TOKEN_STAR);
         case '!':
-            return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+            return makeToken(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
         case '=':
-            return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+            return makeToken(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
         case '<':
-            return makeToken(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+            return makeToken(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
         case '>':
-            return makeToken(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
-        case '"': return string();
+            return makeToken(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+        case '"': return string(scanner);
     }
 
-    return errorToken("Unexpected character.");
+    return errorToken(scanner, "Unexpected character.");
 }
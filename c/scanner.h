@@ -1,12 +1,15 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include <stddef.h>
+
 // TokenType is an enum that represents the type of the token.
 typedef enum {
     // Single-character tokens.
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
-    TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
+    TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
+    TOKEN_COLON, TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
     TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
 
     // One or two character tokens.
@@ -17,11 +20,13 @@ typedef enum {
 
     // Literals.
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
+    // the part of a string literal up to and including "${"; an expression and the rest of the string follow.
+    TOKEN_INTERPOLATION,
 
     // Keywords.
-    TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE,
+    TOKEN_AND, TOKEN_CASE, TOKEN_CLASS, TOKEN_DEFAULT, TOKEN_ELSE, TOKEN_FALSE,
     TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
-    TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
+    TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_SWITCH, TOKEN_THIS,
     TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
 
     TOKEN_ERROR,
@@ -35,7 +40,31 @@ typedef struct {
     int line;
 } Token;
 
-void initScanner(const char* source);
-Token scanToken();
+/*
+ * Scanner chews through the users source code, it tracks how far it's gone.
+ * start: pointer marks the beginning of the current lexeme being scanned.
+ * current: pointer marks the character currently being looked at.
+ * end: one past the last character of the source.
+ *      The source may be a read-only mapping of the file, so there is no '\0' to stop at.
+ * Each compile owns one, so several can scan at once.
+ * */
+#define INTERPOLATION_MAX 8 // "${" nested inside the expression of another "${".
+
+typedef struct {
+    const char* start;
+    const char* current;
+    const char* end;
+    int line;
+    /*
+    One entry per "${" not yet closed, innermost last: how many '{' the expression has
+    opened and not closed. The '}' that arrives when it is zero ends the expression,
+    and the string picks up again after it.
+    */
+    int braces[INTERPOLATION_MAX];
+    int interpolations;
+} Scanner;
+
+void initScanner(Scanner* scanner, const char* source, size_t length);
+Token scanToken(Scanner* scanner);
 
 #endif
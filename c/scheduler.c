@@ -0,0 +1,52 @@
+#include "memory.h"
+#include "scheduler.h"
+
+void initScheduler(Scheduler* scheduler, long slice) {
+    scheduler->tasks = NULL;
+    scheduler->capacity = 0;
+    scheduler->head = 0;
+    scheduler->count = 0;
+    scheduler->slice = slice;
+    scheduler->switches = 0;
+}
+
+void freeScheduler(Scheduler* scheduler) {
+    FREE_ARRAY(VM*, scheduler->tasks, scheduler->capacity);
+    initScheduler(scheduler, scheduler->slice);
+}
+
+void scheduleVM(Scheduler* scheduler, VM* vm) {
+    if (scheduler->count == scheduler->capacity) {
+        // unwrap the ring into the front of a bigger array.
+        int oldCapacity = scheduler->capacity;
+        int capacity = GROW_CAPACITY(oldCapacity);
+        VM** tasks = ALLOCATE(VM*, capacity);
+        for (int i = 0; i < scheduler->count; i++) {
+            tasks[i] = scheduler->tasks[(scheduler->head + i) % oldCapacity];
+        }
+        FREE_ARRAY(VM*, scheduler->tasks, oldCapacity);
+        scheduler->tasks = tasks;
+        scheduler->capacity = capacity;
+        scheduler->head = 0;
+    }
+
+    int tail = (scheduler->head + scheduler->count) % scheduler->capacity;
+    scheduler->tasks[tail] = vm;
+    scheduler->count++;
+}
+
+void runScheduler(Scheduler* scheduler, TaskDoneFn done, void* context) {
+    while (scheduler->count > 0) {
+        VM* vm = scheduler->tasks[scheduler->head];
+        scheduler->head = (scheduler->head + 1) % scheduler->capacity;
+        scheduler->count--;
+
+        InterpreterResult result = resumeScript(vm, scheduler->slice);
+        if (result == INTERPRET_YIELD) {
+            scheduler->switches++;
+            scheduleVM(scheduler, vm);
+        } else if (done != NULL) {
+            done(vm, result, context);
+        }
+    }
+}
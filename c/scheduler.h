@@ -0,0 +1,33 @@
+#ifndef clox_scheduler_h
+#define clox_scheduler_h
+
+#include "common.h"
+#include "vm.h"
+
+/*
+ * Round-robin scheduler: multiplexes many VMs on the calling thread.
+ * Each turn resumes the VM at the front of the queue with one slice of budget.
+ * A VM that yields goes to the back; one that finishes or fails leaves the queue
+ * and is handed to the done callback. A runaway loop can only ever hold the thread
+ * for one slice, so every script makes progress.
+ */
+#define SCHEDULER_SLICE 100000 // default budget per turn, in bytes of bytecode (see VM.budget).
+
+typedef void (*TaskDoneFn)(VM* vm, InterpreterResult result, void* context);
+
+typedef struct {
+    VM** tasks;     // ring of runnable VMs, each with a script loaded by loadScript().
+    int capacity;
+    int head;       // next VM to run.
+    int count;
+    long slice;
+    long switches;  // turns that ended in a yield.
+} Scheduler;
+
+void initScheduler(Scheduler* scheduler, long slice);
+void freeScheduler(Scheduler* scheduler);
+void scheduleVM(Scheduler* scheduler, VM* vm);
+// runs until the queue is empty.
+void runScheduler(Scheduler* scheduler, TaskDoneFn done, void* context);
+
+#endif
@@ -0,0 +1,22 @@
+#include "object.h"
+#include "shape.h"
+#include "table.h"
+
+int shapeFind(ObjShape* shape, ObjString* name) {
+    // each shape adds one field to its parent, so the chain back to the root lists them all.
+    // Names are interned, so comparing pointers is comparing names.
+    for (; shape->parent != NULL; shape = shape->parent) {
+        if (shape->name == name) return shape->fieldCount - 1;
+    }
+    return -1;
+}
+
+ObjShape* shapeTransition(VM* vm, ObjShape* shape, ObjString* name) {
+    Value next;
+    if (tableGet(&shape->transitions, name, &next)) return AS_SHAPE(next);
+
+    // the first instance to take this path creates it; every later one follows it.
+    ObjShape* child = newShape(vm, shape, name);
+    tableSet(&shape->transitions, name, OBJ_VAL(child));
+    return child;
+}
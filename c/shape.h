@@ -0,0 +1,17 @@
+#ifndef clox_shape_h
+#define clox_shape_h
+
+#include "common.h"
+#include "object.h"
+
+/*
+Shape lookups, for the slow path of property access. run() only comes here when a site's
+inline cache misses, and then caches what it found (see PropertyCache in chunk.h).
+*/
+
+// slot of the field in instances of this shape, or -1 if they don't have it.
+int shapeFind(ObjShape* shape, ObjString* name);
+// the shape an instance of this shape moves to when it gains the field.
+ObjShape* shapeTransition(VM* vm, ObjShape* shape, ObjString* name);
+
+#endif
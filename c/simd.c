@@ -0,0 +1,272 @@
+// pthread_once() is POSIX, not ISO C.
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "simd.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define LANES 8 // partial sums; see simd.h.
+
+typedef struct {
+    double (*sum)(const double* a, int count);
+    double (*dot)(const double* a, const double* b, int count);
+    void (*scale)(double* a, int count, double k);
+    void (*addNumber)(double* a, int count, double k);
+    void (*addNumbers)(double* a, const double* b, int count);
+} Kernels;
+
+// the same order in every version, so they all round the same way.
+static double combineLanes(const double* lanes) {
+    return ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6])) + ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+}
+
+static double sumScalar(const double* a, int count) {
+    double lanes[LANES] = {0};
+    for (int i = 0; i < count; i++) lanes[i % LANES] += a[i];
+    return combineLanes(lanes);
+}
+
+static double dotScalar(const double* a, const double* b, int count) {
+    double lanes[LANES] = {0};
+    for (int i = 0; i < count; i++) lanes[i % LANES] += a[i] * b[i];
+    return combineLanes(lanes);
+}
+
+static void scaleScalar(double* a, int count, double k) {
+    for (int i = 0; i < count; i++) a[i] *= k;
+}
+
+static void addNumberScalar(double* a, int count, double k) {
+    for (int i = 0; i < count; i++) a[i] += k;
+}
+
+static void addNumbersScalar(double* a, const double* b, int count) {
+    for (int i = 0; i < count; i++) a[i] += b[i];
+}
+
+#if defined(__x86_64__)
+
+// SSE2 is part of x86-64, so these need no check. Four registers of two lanes each.
+static double sumSSE2(const double* a, int count) {
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd(), s2 = _mm_setzero_pd(), s3 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + LANES <= count; i += LANES) {
+        s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+        s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+        s2 = _mm_add_pd(s2, _mm_loadu_pd(a + i + 4));
+        s3 = _mm_add_pd(s3, _mm_loadu_pd(a + i + 6));
+    }
+    double lanes[LANES];
+    _mm_storeu_pd(lanes, s0);
+    _mm_storeu_pd(lanes + 2, s1);
+    _mm_storeu_pd(lanes + 4, s2);
+    _mm_storeu_pd(lanes + 6, s3);
+    for (; i < count; i++) lanes[i % LANES] += a[i];
+    return combineLanes(lanes);
+}
+
+static double dotSSE2(const double* a, const double* b, int count) {
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd(), s2 = _mm_setzero_pd(), s3 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + LANES <= count; i += LANES) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+        s2 = _mm_add_pd(s2, _mm_mul_pd(_mm_loadu_pd(a + i + 4), _mm_loadu_pd(b + i + 4)));
+        s3 = _mm_add_pd(s3, _mm_mul_pd(_mm_loadu_pd(a + i + 6), _mm_loadu_pd(b + i + 6)));
+    }
+    double lanes[LANES];
+    _mm_storeu_pd(lanes, s0);
+    _mm_storeu_pd(lanes + 2, s1);
+    _mm_storeu_pd(lanes + 4, s2);
+    _mm_storeu_pd(lanes + 6, s3);
+    for (; i < count; i++) lanes[i % LANES] += a[i] * b[i];
+    return combineLanes(lanes);
+}
+
+static void scaleSSE2(double* a, int count, double k) {
+    __m128d factor = _mm_set1_pd(k);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) _mm_storeu_pd(a + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+    for (; i < count; i++) a[i] *= k;
+}
+
+static void addNumberSSE2(double* a, int count, double k) {
+    __m128d term = _mm_set1_pd(k);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) _mm_storeu_pd(a + i, _mm_add_pd(_mm_loadu_pd(a + i), term));
+    for (; i < count; i++) a[i] += k;
+}
+
+static void addNumbersSSE2(double* a, const double* b, int count) {
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(a + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    for (; i < count; i++) a[i] += b[i];
+}
+
+// Two registers of four lanes. No FMA: a fused multiply-add would round differently from the others.
+__attribute__((target("avx2")))
+static double sumAVX2(const double* a, int count) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + LANES <= count; i += LANES) {
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+        s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+    }
+    double lanes[LANES];
+    _mm256_storeu_pd(lanes, s0);
+    _mm256_storeu_pd(lanes + 4, s1);
+    for (; i < count; i++) lanes[i % LANES] += a[i];
+    return combineLanes(lanes);
+}
+
+__attribute__((target("avx2")))
+static double dotAVX2(const double* a, const double* b, int count) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + LANES <= count; i += LANES) {
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+    double lanes[LANES];
+    _mm256_storeu_pd(lanes, s0);
+    _mm256_storeu_pd(lanes + 4, s1);
+    for (; i < count; i++) lanes[i % LANES] += a[i] * b[i];
+    return combineLanes(lanes);
+}
+
+__attribute__((target("avx2")))
+static void scaleAVX2(double* a, int count, double k) {
+    __m256d factor = _mm256_set1_pd(k);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) _mm256_storeu_pd(a + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), factor));
+    for (; i < count; i++) a[i] *= k;
+}
+
+__attribute__((target("avx2")))
+static void addNumberAVX2(double* a, int count, double k) {
+    __m256d term = _mm256_set1_pd(k);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) _mm256_storeu_pd(a + i, _mm256_add_pd(_mm256_loadu_pd(a + i), term));
+    for (; i < count; i++) a[i] += k;
+}
+
+__attribute__((target("avx2")))
+static void addNumbersAVX2(double* a, const double* b, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(a + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    for (; i < count; i++) a[i] += b[i];
+}
+
+#endif
+
+static Kernels kernels = {sumScalar, dotScalar, scaleScalar, addNumberScalar, addNumbersScalar};
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+
+// process-wide, like the stack guard: every VM on every thread uses the same kernels.
+static void selectKernels(void) {
+#if defined(__x86_64__)
+    kernels = (Kernels){sumSSE2, dotSSE2, scaleSSE2, addNumberSSE2, addNumbersSSE2};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels = (Kernels){sumAVX2, dotAVX2, scaleAVX2, addNumberAVX2, addNumbersAVX2};
+    }
+#endif
+}
+
+double sumNumbers(const double* a, int count) {
+    pthread_once(&kernelsOnce, selectKernels);
+    return kernels.sum(a, count);
+}
+
+double dotNumbers(const double* a, const double* b, int count) {
+    pthread_once(&kernelsOnce, selectKernels);
+    return kernels.dot(a, b, count);
+}
+
+void scaleNumbers(double* a, int count, double k) {
+    pthread_once(&kernelsOnce, selectKernels);
+    kernels.scale(a, count, k);
+}
+
+void addNumber(double* a, int count, double k) {
+    pthread_once(&kernelsOnce, selectKernels);
+    kernels.addNumber(a, count, k);
+}
+
+void addNumbers(double* a, const double* b, int count) {
+    pthread_once(&kernelsOnce, selectKernels);
+    kernels.addNumbers(a, b, count);
+}
+
+/*
+Sorting is a radix sort on the bits, not a comparison sort: each double maps to a
+64-bit key that orders the same way as the numbers (flip the sign bit of positives,
+every bit of negatives), and eight byte-wide counting passes sort the keys.
+Passes where every key has the same byte, like the top bytes of numbers of one
+magnitude, are skipped. Short arrays use insertion sort on the keys instead.
+*/
+#define INSERTION_SORT_MAX 32
+
+static uint64_t sortKey(double number) {
+    if (number != number) return UINT64_MAX; // every NaN, whatever its sign and payload, sorts last.
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return (bits & 0x8000000000000000ull) ? ~bits : bits | 0x8000000000000000ull;
+}
+
+static double keyNumber(uint64_t key) {
+    uint64_t bits = (key & 0x8000000000000000ull) ? key & ~0x8000000000000000ull : ~key;
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    return number;
+}
+
+void sortNumbers(double* a, int count) {
+    if (count < 2) return;
+
+    uint64_t* keys = ALLOCATE(uint64_t, count);
+    for (int i = 0; i < count; i++) keys[i] = sortKey(a[i]);
+
+    if (count <= INSERTION_SORT_MAX) {
+        for (int i = 1; i < count; i++) {
+            uint64_t key = keys[i];
+            int j = i - 1;
+            for (; j >= 0 && keys[j] > key; j--) keys[j + 1] = keys[j];
+            keys[j + 1] = key;
+        }
+    } else {
+        uint64_t* scratch = ALLOCATE(uint64_t, count);
+        for (int shift = 0; shift < 64; shift += 8) {
+            int counts[256] = {0};
+            for (int i = 0; i < count; i++) counts[(keys[i] >> shift) & 0xff]++;
+            if (counts[(keys[0] >> shift) & 0xff] == count) continue; // every key has this byte.
+
+            int offset = 0;
+            for (int b = 0; b < 256; b++) {
+                int n = counts[b];
+                counts[b] = offset;
+                offset += n;
+            }
+            for (int i = 0; i < count; i++) scratch[counts[(keys[i] >> shift) & 0xff]++] = keys[i];
+
+            uint64_t* swap = keys;
+            keys = scratch;
+            scratch = swap;
+        }
+        FREE_ARRAY(uint64_t, scratch, count);
+    }
+
+    for (int i = 0; i < count; i++) a[i] = keyNumber(keys[i]);
+    FREE_ARRAY(uint64_t, keys, count);
+}
@@ -0,0 +1,26 @@
+#ifndef clox_simd_h
+#define clox_simd_h
+
+#include "common.h"
+
+/*
+Bulk kernels for number arrays (see ObjNumberArray).
+On x86-64 they use AVX2 when the CPU has it and SSE2 otherwise, picked once at the first call;
+elsewhere they are plain loops.
+
+sumNumbers() and dotNumbers() add in eight interleaved partial sums (element i goes into
+sum i % 8) and combine them in a fixed order, in every version, so the result is the same
+on every machine, though not always the same as adding left to right.
+*/
+double sumNumbers(const double* a, int count);
+double dotNumbers(const double* a, const double* b, int count);
+// a[i] *= k
+void scaleNumbers(double* a, int count, double k);
+// a[i] += k
+void addNumber(double* a, int count, double k);
+// a[i] += b[i]
+void addNumbers(double* a, const double* b, int count);
+// ascending; -0 before 0, NaNs last.
+void sortNumbers(double* a, int count);
+
+#endif
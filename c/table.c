@@ -93,7 +93,7 @@ bool tableSet(Table *table, ObjString* key, Value value) {
     // make sure table is big enough to hold new key and value.
     if (table->count + 1  > table -> capacity * TABLE_MAX_LOAD) {
         int capacity = GROW_CAPACITY(table->capacity);
-        adjustTableSize(table, capacity);
+        adjustCapacity(table, capacity);
     }
     
     Entry* entry = findEntry(table->entries, table->capacity, key);
@@ -107,8 +107,19 @@ bool tableSet(Table *table, ObjString* key, Value value) {
     return isNewKey;
 }
 
+bool tableDelete(Table* table, ObjString* key) {
+    if (table->count == 0) return false;
+
+    Entry* entry = findEntry(table->entries, table->capacity, key);
+    if (entry->key == NULL) return false;
+
+    entry->key = NULL;
+    entry->value = BOOL_VAL(true);
+    return true;
+}
+
 void tableAddAll(Table* from, Table* to) {
-    for (int i = 0; i < from->count; i++) {
+    for (int i = 0; i < from->capacity; i++) {
         Entry* entry = &from->entries[i];
 
         if (entry->key != NULL) {
@@ -117,15 +128,15 @@ void tableAddAll(Table* from, Table* to) {
     }
 }
 
-ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
+ObjString* tableFindString(const Table* table, const char* chars, int length, uint32_t hash) {
     if (table->count == 0) return NULL;
 
-    uint32_t index = hash % table->count;
+    uint32_t index = hash % table->capacity;
 
     for (;;) {
         Entry* entry = &table->entries[index];
 
-        if (entry->key != NULL) {
+        if (entry->key == NULL) {
             if (IS_NIL(entry->value)) return NULL;
         } else if (entry->key->length == length &&
             entry->key->hash == hash &&
@@ -136,4 +147,157 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
         index = (index + 1) % table->capacity;
     }
 
-}
\ No newline at end of file
+}
+
+#define VALUE_TABLE_MIN_SLOTS 8
+
+bool isHashableKey(Value key) {
+    if (IS_NUMBER(key)) return AS_NUMBER(key) == AS_NUMBER(key);
+    return IS_NIL(key) || IS_BOOL(key) || IS_STRING(key);
+}
+
+/*
+Numbers are hashed by their bits, with -0 first turned into 0 since the two are equal.
+Whole numbers differ only in their high bits, so the bits are mixed (MurmurHash3's
+finalizer) before they are cut down to 32.
+*/
+static uint32_t hashNumber(double number) {
+    if (number == 0) number = 0;
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ull;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+uint32_t hashValue(Value key) {
+    switch (key.type) {
+        case VAL_BOOL: return AS_BOOL(key) ? 1231 : 1237;
+        case VAL_NIL: return 0x9e3779b9;
+        case VAL_NUMBER: return hashNumber(AS_NUMBER(key));
+        case VAL_OBJ: return AS_STRING(key)->hash; // strings are the only objects isHashableKey() lets in.
+    }
+    return 0;
+}
+
+void initValueTable(ValueTable* table) {
+    table->count = 0;
+    table->entries = NULL;
+    table->entryCount = 0;
+    table->entryCapacity = 0;
+    table->slots = NULL;
+    table->slotCapacity = 0;
+}
+
+void freeValueTable(ValueTable* table) {
+    FREE_ARRAY(MapEntry, table->entries, table->entryCapacity);
+    FREE_ARRAY(int32_t, table->slots, table->slotCapacity);
+    initValueTable(table);
+}
+
+// the slot holding the key's entry, or the empty one the probe for it stopped at.
+static int32_t* findSlot(const ValueTable* table, Value key, uint32_t hash) {
+    uint32_t mask = (uint32_t)table->slotCapacity - 1;
+    for (uint32_t index = hash & mask;; index = (index + 1) & mask) {
+        int32_t* slot = &table->slots[index];
+        if (*slot == SLOT_EMPTY) return slot;
+        if (*slot == SLOT_TOMBSTONE) continue;
+
+        MapEntry* entry = &table->entries[*slot];
+        // keys are numbers, strings (interned), booleans or nil, so valuesEqual() is equality by value.
+        if (entry->hash == hash && valuesEqual(entry->key, key)) return slot;
+    }
+}
+
+/*
+Drops deleted entries and rebuilds the index with room for capacity entries.
+Because deleted entries go away here too, a table that has as many deletes as inserts
+gets rebuilt at the same size instead of growing.
+*/
+static void rebuild(ValueTable* table, int capacity) {
+    int live = 0;
+    for (int i = 0; i < table->entryCount; i++) {
+        if (!table->entries[i].deleted) table->entries[live++] = table->entries[i];
+    }
+    table->entryCount = live;
+
+    if (capacity > table->entryCapacity) {
+        table->entries = GROW_ARRAY(MapEntry, table->entries, table->entryCapacity, capacity);
+        table->entryCapacity = capacity;
+    }
+
+    // enough slots that a full entries array leaves some empty, so every probe ends.
+    int slotCapacity = VALUE_TABLE_MIN_SLOTS;
+    while (slotCapacity * TABLE_MAX_LOAD < table->entryCapacity) slotCapacity *= 2;
+    if (slotCapacity != table->slotCapacity) {
+        FREE_ARRAY(int32_t, table->slots, table->slotCapacity);
+        table->slots = ALLOCATE(int32_t, slotCapacity);
+        table->slotCapacity = slotCapacity;
+    }
+    for (int i = 0; i < slotCapacity; i++) table->slots[i] = SLOT_EMPTY;
+
+    for (int i = 0; i < table->entryCount; i++) {
+        *findSlot(table, table->entries[i].key, table->entries[i].hash) = i;
+    }
+}
+
+void valueTableReserve(ValueTable* table, int count) {
+    if (count > table->entryCapacity) rebuild(table, count);
+}
+
+bool valueTableGet(const ValueTable* table, Value key, Value* value) {
+    if (table->count == 0) return false;
+
+    int32_t* slot = findSlot(table, key, hashValue(key));
+    if (*slot == SLOT_EMPTY) return false;
+
+    *value = table->entries[*slot].value;
+    return true;
+}
+
+bool valueTableSet(ValueTable* table, Value key, Value value) {
+    uint32_t hash = hashValue(key);
+    if (table->count > 0) {
+        int32_t* slot = findSlot(table, key, hash);
+        if (*slot != SLOT_EMPTY) {
+            table->entries[*slot].value = value;
+            return false;
+        }
+    }
+
+    // a new key: it goes at the end of entries, so entryCount bounds the slots in use.
+    if (IS_NUMBER(key) && AS_NUMBER(key) == 0) key = NUMBER_VAL(0); // stored, and printed, as 0, not -0.
+    if (table->entryCount + 1 > table->entryCapacity) {
+        // double only if live entries fill the table; otherwise compacting makes the room.
+        int capacity = table->count + 1 > table->entryCapacity / 2 ? GROW_CAPACITY(table->entryCapacity)
+                                                                  : table->entryCapacity;
+        rebuild(table, capacity);
+    }
+
+    MapEntry* entry = &table->entries[table->entryCount];
+    entry->key = key;
+    entry->value = value;
+    entry->hash = hash;
+    entry->deleted = false;
+    *findSlot(table, key, hash) = table->entryCount++;
+    table->count++;
+    return true;
+}
+
+bool valueTableDelete(ValueTable* table, Value key) {
+    if (table->count == 0) return false;
+
+    int32_t* slot = findSlot(table, key, hashValue(key));
+    if (*slot == SLOT_EMPTY) return false;
+
+    MapEntry* entry = &table->entries[*slot];
+    entry->deleted = true;
+    entry->key = NIL_VAL;
+    entry->value = NIL_VAL;
+    *slot = SLOT_TOMBSTONE;
+    table->count--;
+    return true;
+}
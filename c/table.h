@@ -19,7 +19,47 @@ void initTable(Table* table);
 void freeTable(Table* table);
 bool tableGet(Table* table, ObjString* key, Value* value);
 bool tableSet(Table* table, ObjString* key, Value value);
+bool tableDelete(Table* table, ObjString* key);
 void tableAddAll(Table* from, Table* to);
-ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
+ObjString* tableFindString(const Table* table, const char* chars, int length, uint32_t hash);
+
+/*
+A hash table keyed by Values (numbers, strings, booleans, nil), for the map objects
+scripts create; Table above stays the faster string-only table the VM uses itself.
+
+entries are kept in insertion order and slots is the hash index into them, so walking
+entries visits the keys in the order they were first set. Deleting marks the entry
+and leaves a tombstone slot; both are dropped the next time the index is rebuilt.
+*/
+#define SLOT_EMPTY (-1)
+#define SLOT_TOMBSTONE (-2)
+
+typedef struct {
+    Value key;
+    Value value;
+    uint32_t hash;
+    bool deleted;
+} MapEntry;
+
+typedef struct {
+    int count;          // live entries.
+    MapEntry* entries;
+    int entryCount;     // used entries, deleted ones included.
+    int entryCapacity;
+    int32_t* slots;     // entry index, SLOT_EMPTY or SLOT_TOMBSTONE.
+    int slotCapacity;   // zero or a power of two.
+} ValueTable;
+
+// only keys that can be hashed by value; NaN is not one, since it equals nothing.
+bool isHashableKey(Value key);
+uint32_t hashValue(Value key);
+
+void initValueTable(ValueTable* table);
+void freeValueTable(ValueTable* table);
+// makes room for count entries, so filling the table up to that doesn't rebuild the index.
+void valueTableReserve(ValueTable* table, int count);
+bool valueTableGet(const ValueTable* table, Value key, Value* value);
+bool valueTableSet(ValueTable* table, Value key, Value value);
+bool valueTableDelete(ValueTable* table, Value key);
 
 #endif
\ No newline at end of file
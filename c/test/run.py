@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""
+Runs the clox behaviour tests.
+
+    make test
+
+    python3 test/run.py --clox build/release/clox test/*.lox
+    python3 test/run.py --clox build/release/clox --update test/unchecked_ops.lox
+
+Each test/<name>.lox is run from the test directory and its output is compared with
+test/<name>.expected: the script's standard output, then its standard error, then a last
+line 'exit: <status>'. A script whose first line is '// args: <arguments>' is run as
+'clox <arguments>' instead of 'clox <name>.lox', for tests that need a mode such as
+--interleave. Scripts in subdirectories are helpers those tests name; they are not run
+on their own.
+
+With --update, the .expected files are rewritten from the current output instead.
+The exit status is 1 when any test fails.
+"""
+
+import argparse
+import difflib
+import os
+import shlex
+import subprocess
+import sys
+
+ARGS_PREFIX = "// args:"
+
+
+def arguments(path):
+    with open(path) as file:
+        first = file.readline()
+    if first.startswith(ARGS_PREFIX):
+        return shlex.split(first[len(ARGS_PREFIX):])
+    return [os.path.basename(path)]
+
+
+def run(clox, path):
+    result = subprocess.run([clox] + arguments(path), cwd=os.path.dirname(path),
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, timeout=60)
+    return (result.stdout.decode(errors="replace") + result.stderr.decode(errors="replace") +
+            "exit: %d\n" % result.returncode)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--clox", required=True, help="interpreter to test")
+    parser.add_argument("--update", action="store_true", help="rewrite the .expected files")
+    parser.add_argument("tests", nargs="+", help=".lox test scripts")
+    options = parser.parse_args()
+
+    clox = os.path.abspath(options.clox)
+    failed = 0
+    for test in options.tests:
+        path = os.path.abspath(test)
+        expected_path = os.path.splitext(path)[0] + ".expected"
+        actual = run(clox, path)
+
+        if options.update:
+            with open(expected_path, "w") as file:
+                file.write(actual)
+            continue
+
+        try:
+            with open(expected_path) as file:
+                expected = file.read()
+        except FileNotFoundError:
+            expected = ""
+        if actual != expected:
+            failed += 1
+            print("FAIL %s" % test)
+            sys.stdout.writelines(difflib.unified_diff(
+                expected.splitlines(keepends=True), actual.splitlines(keepends=True),
+                os.path.relpath(expected_path), "actual"))
+
+    if not options.update:
+        print("%d of %d tests passed" % (len(options.tests) - failed, len(options.tests)))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,169 @@
+// open(), write() and sigaction() are POSIX, not ISO C.
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "debug.h"
+#include "memory.h"
+#include "object.h"
+#include "trace.h"
+
+/*
+ * File layout:
+ *   char     magic[8]     TRACE_MAGIC
+ *   uint32_t recordSize   sizeof(TraceRecord), so a decoder built differently can refuse the file.
+ *   uint32_t reserved
+ *   uint64_t count        records that follow, oldest first.
+ *   TraceRecord records[count]
+ * Native byte order; the decoder is expected to run on the same kind of machine.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t recordSize;
+    uint32_t reserved;
+    uint64_t count;
+} TraceHeader;
+
+static FlightRecorder recorder;
+static const char* tracePath;
+
+static void writeAll(int fd, const void* data, size_t size) {
+    const char* bytes = data;
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written <= 0) return;
+        bytes += written;
+        size -= (size_t)written;
+    }
+}
+
+// only uses async-signal-safe calls, because SIGUSR1 dumps from inside the handler.
+void dumpTrace() {
+    if (!recorder.enabled) return;
+
+    int fd = open(tracePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+
+    uint64_t next = recorder.next;
+    uint64_t count = next < TRACE_CAPACITY ? next : TRACE_CAPACITY;
+    TraceHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.recordSize = sizeof(TraceRecord);
+    header.reserved = 0;
+    header.count = count;
+    writeAll(fd, &header, sizeof(header));
+
+    // once the ring has wrapped, the oldest record sits right after the newest one.
+    size_t oldest = (size_t)(next - count) & TRACE_MASK;
+    size_t firstPart = TRACE_CAPACITY - oldest < count ? TRACE_CAPACITY - oldest : (size_t)count;
+    writeAll(fd, &recorder.records[oldest], firstPart * sizeof(TraceRecord));
+    writeAll(fd, &recorder.records[0], ((size_t)count - firstPart) * sizeof(TraceRecord));
+    close(fd);
+}
+
+static void onDumpRequest(int signal) {
+    (void)signal;
+    dumpTrace();
+}
+
+FlightRecorder* startTrace(const char* path) {
+    tracePath = path;
+    recorder.next = 0;
+    recorder.enabled = true;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onDumpRequest;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+    return &recorder;
+}
+
+static const char* typeName(uint8_t type) {
+    switch (type) {
+        case VAL_BOOL: return "bool";
+        case VAL_NIL: return "nil";
+        case VAL_NUMBER: return "number";
+        case VAL_OBJ: return "obj";
+        case TRACE_EMPTY_STACK: return "-";
+        default: return "?";
+    }
+}
+
+// every function compiled from the script, by ordinal. Nested functions are constants of their enclosing one.
+typedef struct {
+    ObjFunction** functions;
+    int capacity;
+} FunctionIndex;
+
+static void indexFunctions(FunctionIndex* index, ObjFunction* function) {
+    if (function->ordinal >= index->capacity) {
+        int oldCapacity = index->capacity;
+        while (index->capacity <= function->ordinal) index->capacity = GROW_CAPACITY(index->capacity);
+        index->functions = GROW_ARRAY(ObjFunction*, index->functions, oldCapacity, index->capacity);
+        memset(index->functions + oldCapacity, 0, sizeof(ObjFunction*) * (index->capacity - oldCapacity));
+    }
+    index->functions[function->ordinal] = function;
+
+    ValueArray* constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (IS_FUNCTION(constants->values[i])) indexFunctions(index, AS_FUNCTION(constants->values[i]));
+    }
+}
+
+/*
+ * Offline decoder. Compiling the same script again gives back the exact functions the
+ * records refer to, numbered the same way, so each record is printed with the regular disassembler.
+ */
+bool decodeTrace(VM* vm, const char* path, const char* source, size_t length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open trace \"%s\".\n", path);
+        return false;
+    }
+
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.recordSize != sizeof(TraceRecord)) {
+        fprintf(stderr, "\"%s\" is not a clox trace.\n", path);
+        fclose(file);
+        return false;
+    }
+
+    ObjFunction* script = compile(vm, source, length, NULL);
+    if (script == NULL) {
+        fclose(file);
+        return false;
+    }
+    FunctionIndex index = {NULL, 0};
+    indexFunctions(&index, script);
+
+    printf("== trace: %llu records ==\n", (unsigned long long)header.count);
+    printf("%8s %5s %-6s %-12s %s\n", "#", "depth", "top", "function", "instruction");
+    TraceRecord record;
+    for (uint64_t i = 0; i < header.count && fread(&record, sizeof(record), 1, file) == 1; i++) {
+        printf("%8llu %5u %-6s ", (unsigned long long)i, record.depth, typeName(record.topType));
+        ObjFunction* function = record.function < index.capacity ? index.functions[record.function] : NULL;
+        if (function == NULL || record.offset >= (uint32_t)function->chunk.count ||
+            function->chunk.code[record.offset] != record.opcode) {
+            // the script changed since the trace was taken.
+            printf("%-12s %04u %s (not in this script)\n", "?", record.offset, opcodeName(record.opcode));
+            continue;
+        }
+        printf("%-12s ", function->name != NULL ? function->name->chars : "<script>");
+        disassembleInstruction(&function->chunk, (int)record.offset);
+    }
+
+    FREE_ARRAY(ObjFunction*, index.functions, index.capacity);
+    fclose(file);
+    return true;
+}
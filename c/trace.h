@@ -0,0 +1,49 @@
+#ifndef clox_trace_h
+#define clox_trace_h
+
+#include "common.h"
+#include "value.h"
+#include "vm.h"
+
+/*
+ * Flight-recorder tracing (clox --trace <file> <script>).
+ * While enabled, run() appends one compact binary record per instruction to a fixed-size
+ * ring buffer, so only the last TRACE_CAPACITY instructions are kept and recording never allocates.
+ * The ring is written to the trace file on runtimeError(), on SIGUSR1, and at exit,
+ * and `clox --decode-trace <file> <script>` turns it back into a disassembly listing.
+ */
+#define TRACE_CAPACITY (1 << 16) // power of two.
+#define TRACE_MASK (TRACE_CAPACITY - 1)
+#define TRACE_MAGIC "CLOXTRC1"
+#define TRACE_EMPTY_STACK 0xff    // topType when there is nothing on the stack.
+
+typedef struct {
+    uint32_t offset;   // of the opcode in the function's chunk.
+    uint16_t function; // ObjFunction.ordinal of the function running.
+    uint16_t depth;    // number of values on the stack.
+    uint8_t opcode;
+    uint8_t topType;   // ValueType of the top of the stack.
+} TraceRecord;
+
+struct FlightRecorder {
+    bool enabled;
+    uint64_t next; // total records written; the ring holds the last TRACE_CAPACITY of them.
+    TraceRecord records[TRACE_CAPACITY];
+};
+
+static inline void traceInstruction(FlightRecorder* recorder, int function, uint32_t offset, uint8_t opcode,
+                                    Value* stack, Value* stackTop) {
+    TraceRecord* record = &recorder->records[recorder->next++ & TRACE_MASK];
+    record->offset = offset;
+    record->function = (uint16_t)function;
+    record->opcode = opcode;
+    record->topType = stackTop > stack ? (uint8_t)stackTop[-1].type : TRACE_EMPTY_STACK;
+    record->depth = (uint16_t)(stackTop - stack);
+}
+
+// there is one recorder per process; the caller attaches it to the VM it wants traced.
+FlightRecorder* startTrace(const char* path);
+void dumpTrace();
+bool decodeTrace(VM* vm, const char* tracePath, const char* source, size_t length);
+
+#endif
@@ -28,14 +28,18 @@ void freeValueArray(ValueArray* array) {
 }
 
 void printValue(Value value) {
+    fprintValue(stdout, value);
+}
+
+void fprintValue(FILE* out, Value value) {
     switch (value.type)
     {
     case VAL_BOOL:
-        printf(AS_BOOL(value) ? "true" : "false");
+        fputs(AS_BOOL(value) ? "true" : "false", out);
         break;
-    case VAL_NIL: printf("nil"); break;
-    case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
-    case VAL_OBJ: printObject(value); break;
+    case VAL_NIL: fputs("nil", out); break;
+    case VAL_NUMBER: fprintf(out, "%g", AS_NUMBER(value)); break;
+    case VAL_OBJ: printObject(out, value); break;
     }
 }
 
@@ -1,6 +1,8 @@
 #ifndef clox_value_h
 #define clox_value_h
 
+#include <stdio.h>
+
 #include "common.h"
 
 /*
@@ -14,6 +16,10 @@ And the actual definition is in a new module. -> object.h
 */
 typedef struct Obj Obj; // forward declaration.
 typedef struct ObjString ObjString; // forward declaration.
+typedef struct ObjShape ObjShape; // forward declaration; chunks cache shapes (see PropertyCache).
+typedef struct ObjClass ObjClass; // forward declaration; chunks cache methods (see MethodCache).
+typedef struct ObjFunction ObjFunction; // forward declaration.
+typedef struct ObjUpvalue ObjUpvalue; // forward declaration.
 
 typedef enum {
     VAL_BOOL,
@@ -61,5 +67,6 @@ void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
 void printValue(Value value);
+void fprintValue(FILE* out, Value value);
 
 #endif
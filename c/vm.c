@@ -1,67 +1,727 @@
+// mmap(MAP_ANONYMOUS), sigaction(), sigsetjmp() and pthread_once() are POSIX/BSD, not ISO C.
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
 #include "object.h"
 #include "memory.h"
+#include "natives.h"
+#include "profile.h"
+#include "sampler.h"
+#include "shape.h"
+#include "trace.h"
 #include "vm.h"
 
-VM vm;
+/*
+The value stack is one big anonymous mapping followed by a PROT_NONE guard page.
+The OS only commits the pages the stack actually touches, so the reservation is cheap,
+and running off the end faults on the guard page instead of corrupting memory.
+The SIGSEGV handler turns that fault into a jump back to interpret(), which reports
+a runtime error, so push() never compares against a limit.
+Every VM has its own stack. The fault is delivered to the thread that touched the guard page,
+so each thread records the VM it is running and where to jump.
+*/
+static size_t guardPageSize;
+static _Thread_local VM* runningVM = NULL;          // set only while run() executes.
+static _Thread_local sigjmp_buf* stackOverflowJump;
+
+static void onSegfault(int signal, siginfo_t* info, void* context) {
+    (void)context;
+    char* address = (char*)info->si_addr;
+    VM* vm = runningVM;
+    if (vm != NULL) {
+        char* guard = (char*)(vm->stack + vm->stackCapacity);
+        if (address >= guard && address < guard + guardPageSize) {
+            siglongjmp(*stackOverflowJump, 1);
+        }
+    }
+
+    // a real crash; let it happen with the default action.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigaction(signal, &action, NULL);
+}
+
+// process-wide: runs once, however many VMs are created and on whichever threads.
+static void installStackGuard() {
+    guardPageSize = (size_t)sysconf(_SC_PAGESIZE);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = onSegfault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+#ifdef SIGBUS
+    sigaction(SIGBUS, &action, NULL); // some systems report guard page hits as SIGBUS.
+#endif
+}
+
+static void reserveStack(VM* vm) {
+    static pthread_once_t guardOnce = PTHREAD_ONCE_INIT;
+    pthread_once(&guardOnce, installStackGuard);
+
+    size_t stackBytes = (size_t)STACK_MAX * sizeof(Value);
+    stackBytes = (stackBytes + guardPageSize - 1) / guardPageSize * guardPageSize;
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    void* base = mmap(NULL, stackBytes + guardPageSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (base == MAP_FAILED) exit(1);
+    mprotect((char*)base + stackBytes, guardPageSize, PROT_NONE);
+
+    vm->stack = (Value*)base;
+    vm->stackCapacity = (int)(stackBytes / sizeof(Value));
+}
+
+static void releaseStack(VM* vm) {
+    size_t stackBytes = (size_t)vm->mainFiber->stackCapacity * sizeof(Value);
+    munmap(vm->mainFiber->stack, stackBytes + guardPageSize);
+}
+
+static void closeUpvalues(VM* vm, Value* last);
+
+// the running fiber's registers go back into it. Only pointers move; no values are copied.
+static void saveFiber(VM* vm) {
+    ObjFiber* fiber = vm->fiber;
+    fiber->frames = vm->frames;
+    fiber->frameCount = vm->frameCount;
+    fiber->stack = vm->stack;
+    fiber->stackCapacity = vm->stackCapacity;
+    fiber->stackTop = vm->stackTop;
+    fiber->openUpvalues = vm->openUpvalues;
+}
+
+static void loadFiber(VM* vm, ObjFiber* fiber) {
+    // the line sampler skips a VM with no frames, so it never pairs one fiber's frames with another's count.
+    // only the signal handler reads the zero, so without the fences the compiler would drop it as a dead
+    // store, or move the other stores past the final count.
+    vm->frameCount = 0;
+    atomic_signal_fence(memory_order_seq_cst);
+    vm->fiber = fiber;
+    vm->frames = fiber->frames;
+    vm->stack = fiber->stack;
+    vm->stackCapacity = fiber->stackCapacity;
+    vm->stackTop = fiber->stackTop;
+    vm->openUpvalues = fiber->openUpvalues;
+    atomic_signal_fence(memory_order_seq_cst);
+    vm->frameCount = fiber->frameCount;
+}
+
+// the running fiber is done: its stack goes back to the pool and its caller runs again.
+static void endFiber(VM* vm) {
+    ObjFiber* fiber = vm->fiber;
+    closeUpvalues(vm, vm->stack); // closures made in it keep their variables after the stack is reused.
+    fiber->state = FIBER_DONE;
+    releaseFiberStack(&vm->fiberPool, fiber);
+
+    ObjFiber* caller = fiber->caller;
+    fiber->caller = NULL;
+    loadFiber(vm, caller);
+}
 
-static void resetStack() {
-    vm.stackTop = vm.stack;
+static void resetStack(VM* vm) {
+    // a runtime error ends the fiber it happened in and every fiber waiting on it, back to the main script.
+    while (vm->fiber != vm->mainFiber) endFiber(vm);
+    vm->stackTop = vm->stack;
+    vm->frameCount = 0;
+    vm->openUpvalues = NULL;
+}
+
+#define TRACE_EDGE_FRAMES 8 // stack trace lines kept at each end of a deep stack.
+
+static void printFrames(VM* vm, CallFrame* frames, int frameCount) {
+    for (int i = frameCount - 1; i >= 0; i--) {
+        if (i == frameCount - 1 - TRACE_EDGE_FRAMES && i >= TRACE_EDGE_FRAMES) {
+            fprintf(vm->err, "... %d more calls\n", i + 1 - TRACE_EDGE_FRAMES);
+            i = TRACE_EDGE_FRAMES - 1;
+        }
+        CallFrame* frame = &frames[i];
+        ObjFunction* function = frame->function;
+        size_t instruction = frame->ip - function->chunk.code - 1;
+        fprintf(vm->err, "[line %d] in ", function->chunk.lines[instruction]);
+        if (function->name == NULL) {
+            fprintf(vm->err, "script\n");
+        } else {
+            fprintf(vm->err, "%s()\n", function->name->chars);
+        }
+    }
 }
 
-static void runtimeError(const char* format, ...) {
+void runtimeError(VM* vm, const char* format, ...) {
     va_list args;  // let us pass an arbitrary number of arguments to runtimeError()
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->err, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->err);
 
-    size_t instruction = vm.ip - vm.chunk->code - 1;
-    int line = vm.chunk->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
-    resetStack();
+    // innermost call first, then the fibers that resumed this one. Runaway recursion would print
+    // a thousand identical lines, so the middle of each fiber's calls is cut.
+    saveFiber(vm);
+    for (ObjFiber* fiber = vm->fiber; fiber != NULL; fiber = fiber->caller) {
+        printFrames(vm, fiber->frames, fiber->frameCount);
+    }
+    if (vm->recorder != NULL) dumpTrace(); // the flight recorder holds the instructions that led here.
+    resetStack(vm);
 }
 
-void initVM() {
-    resetStack();
-    vm.objects = NULL;
-    initTable(&vm.globals);
-    initTable(&vm.strings);
+void initVM(VM* vm, const Table* sharedStrings) {
+    vm->objects = NULL;
+    reserveStack(vm);
+    vm->frames = ALLOCATE(CallFrame, FRAMES_MAX);
+    vm->mainFiber = newFiber(vm, NIL_VAL);
+    vm->mainFiber->state = FIBER_RUNNING;
+    vm->fiber = vm->mainFiber;
+    initFiberPool(&vm->fiberPool);
+    resetStack(vm);
+    vm->recorder = NULL;
+    vm->out = stdout;
+    vm->err = stderr;
+    initTable(&vm->globals);
+    initTable(&vm->strings);
+    vm->sharedStrings = sharedStrings;
+    vm->emptyShape = newShape(vm, NULL, NULL);
+    vm->budget = BUDGET_UNLIMITED;
+    defineNatives(vm);
 };
 
-void freeVM() {
-    freeTable(&vm.globals);
-    freeTable(&vm.strings);
-    freeObjects();
+
+static ObjNative* addNative(VM* vm, const char* name, NativeSignature signature, int arity) {
+    ObjString* string = copyString(vm, name, (int)strlen(name));
+    ObjNative* native = newNative(vm, string, signature, arity);
+    tableSet(&vm->globals, string, OBJ_VAL(native));
+    return native;
+}
+
+void defineNative(VM* vm, const char* name, int arity, NativeFn function) {
+    addNative(vm, name, NATIVE_VALUES, arity)->as.values = function;
+}
+
+void defineUnaryNative(VM* vm, const char* name, UnaryNativeFn function) {
+    addNative(vm, name, NATIVE_UNARY, 1)->as.unary = function;
+}
+
+void defineBinaryNative(VM* vm, const char* name, BinaryNativeFn function) {
+    addNative(vm, name, NATIVE_BINARY, 2)->as.binary = function;
+}
+
+void freeVM(VM* vm) {
+    // functions are objects, so a script that was suspended and never finished goes with the rest.
+    saveFiber(vm); // whichever fiber ran last, the main one's stack and frames are in it now.
+    releaseStack(vm);
+    FREE_ARRAY(CallFrame, vm->mainFiber->frames, FRAMES_MAX);
+    freeFiberPool(&vm->fiberPool);
+    freeTable(&vm->globals);
+    freeTable(&vm->strings);
+    freeObjects(vm);
 };
 
-void push(Value value) {
-    *vm.stackTop = value;
-    vm.stackTop++;
+void push(VM* vm, Value value) {
+    *vm->stackTop = value;
+    vm->stackTop++;
 };
 
-Value pop() {
-    vm.stackTop--;
-    return *vm.stackTop;
+Value pop(VM* vm) {
+    vm->stackTop--;
+    return *vm->stackTop;
 };
 
-static Value peek(int distance) {
-    return vm.stackTop[-1 - distance];
+static Value peek(VM* vm, int distance) {
+    return vm->stackTop[-1 - distance];
+}
+
+/*
+Push a frame for the callee. Its arguments are already on the stack right above it,
+and they become the first slots of the new frame where they are: nothing is copied.
+The fields are filled in before frameCount moves, so the line sampler never sees a half-made frame;
+the release fence keeps the compiler from sinking them below the increment (onSample() has the acquire).
+*/
+static inline bool call(VM* vm, ObjFunction* function, ObjUpvalue** upvalues, int argCount) {
+    if (argCount != function->arity) {
+        runtimeError(vm, "Expected %d arguments but got %d.", function->arity, argCount);
+        return false;
+    }
+
+    // the value stack needs no check here: running off its end hits the guard page.
+    if (vm->frameCount == FRAMES_MAX) {
+        runtimeError(vm, "Stack overflow.");
+        return false;
+    }
+
+    CallFrame* frame = &vm->frames[vm->frameCount];
+    frame->function = function;
+    frame->upvalues = upvalues;
+    frame->ip = function->chunk.code;
+    frame->slots = vm->stackTop - argCount - 1;
+    atomic_signal_fence(memory_order_release);
+    vm->frameCount++;
+
+    // recursion has no OP_LOOP to charge, so every call pays for the callee's code up front.
+    vm->budget -= function->chunk.count;
+    return true;
+}
+
+/*
+No frame is pushed: the native runs on the caller's stack, and its result replaces
+the callee and the arguments like a returning function's would.
+*/
+static bool callNative(VM* vm, ObjNative* native, int argCount) {
+    if (native->arity != -1 && argCount != native->arity) {
+        runtimeError(vm, "Expected %d arguments but got %d.", native->arity, argCount);
+        return false;
+    }
+
+    Value* args = vm->stackTop - argCount;
+    switch (native->signature) {
+        case NATIVE_VALUES: {
+            ObjFiber* fiber = vm->fiber;
+            if (!native->as.values(vm, argCount, args)) return false;
+            // resume() or yield() switched fibers and already left both stacks as they should be.
+            if (vm->fiber != fiber) return true;
+            break;
+        }
+        case NATIVE_UNARY:
+            if (!IS_NUMBER(args[0])) {
+                runtimeError(vm, "Argument must be a number.");
+                return false;
+            }
+            args[-1] = NUMBER_VAL(native->as.unary(AS_NUMBER(args[0])));
+            break;
+        case NATIVE_BINARY:
+            if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) {
+                runtimeError(vm, "Arguments must be numbers.");
+                return false;
+            }
+            args[-1] = NUMBER_VAL(native->as.binary(AS_NUMBER(args[0]), AS_NUMBER(args[1])));
+            break;
+    }
+    vm->stackTop = args;
+    return true;
+}
+
+static bool callValue(VM* vm, Value callee, int argCount) {
+    if (IS_OBJ(callee)) {
+        switch (OBJ_TYPE(callee)) {
+            case OBJ_BOUND_METHOD: {
+                // the receiver takes the callee's slot, which is slot 0, 'this', in the method.
+                ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+                vm->stackTop[-argCount - 1] = bound->receiver;
+                return callValue(vm, bound->method, argCount);
+            }
+            case OBJ_CLASS: {
+                ObjClass* klass = AS_CLASS(callee);
+                vm->stackTop[-argCount - 1] = OBJ_VAL(newInstance(vm, klass));
+                if (!IS_NIL(klass->initializer)) {
+                    return callValue(vm, klass->initializer, argCount);
+                } else if (argCount != 0) {
+                    runtimeError(vm, "Expected 0 arguments but got %d.", argCount);
+                    return false;
+                }
+                return true;
+            }
+            case OBJ_CLOSURE: {
+                ObjClosure* closure = AS_CLOSURE(callee);
+                return call(vm, closure->function, closure->upvalues, argCount);
+            }
+            case OBJ_FUNCTION:
+                return call(vm, AS_FUNCTION(callee), NULL, argCount);
+            case OBJ_NATIVE:
+                return callNative(vm, AS_NATIVE(callee), argCount);
+            default:
+                break; // Non-callable object type.
+        }
+    }
+    runtimeError(vm, "Can only call functions and classes.");
+    return false;
+}
+
+bool resumeFiber(VM* vm, ObjFiber* fiber, Value value, Value* slot) {
+    if (fiber->state == FIBER_DONE) {
+        runtimeError(vm, "Can't resume a finished fiber.");
+        return false;
+    }
+    if (fiber->state == FIBER_RUNNING) {
+        runtimeError(vm, "Can't resume a running fiber.");
+        return false;
+    }
+
+    // a new fiber gets its stack before anything is saved, so a failure is reported where resume() was called.
+    if (fiber->state == FIBER_NEW && !acquireFiberStack(&vm->fiberPool, fiber)) {
+        runtimeError(vm, "Out of memory for fiber stacks.");
+        return false;
+    }
+
+    vm->stackTop = slot; // resume()'s result is pushed here when the fiber yields or returns.
+    saveFiber(vm);
+    fiber->caller = vm->fiber;
+
+    if (fiber->state == FIBER_NEW) {
+        loadFiber(vm, fiber);
+        fiber->state = FIBER_RUNNING;
+
+        // the function is called at the bottom of the new stack: itself (or a method's receiver) in slot 0,
+        // then the value if it takes one.
+        Value callee = fiber->function;
+        if (IS_BOUND_METHOD(callee)) {
+            push(vm, AS_BOUND_METHOD(callee)->receiver);
+            callee = AS_BOUND_METHOD(callee)->method;
+        } else {
+            push(vm, callee);
+        }
+        ObjFunction* function = IS_CLOSURE(callee) ? AS_CLOSURE(callee)->function : AS_FUNCTION(callee);
+        ObjUpvalue** upvalues = IS_CLOSURE(callee) ? AS_CLOSURE(callee)->upvalues : NULL;
+        if (function->arity == 1) push(vm, value);
+        return call(vm, function, upvalues, function->arity);
+    }
+
+    loadFiber(vm, fiber);
+    fiber->state = FIBER_RUNNING;
+    push(vm, value); // what yield() returns in the fiber.
+    return true;
+}
+
+bool yieldFiber(VM* vm, Value value, Value* slot) {
+    ObjFiber* fiber = vm->fiber;
+    if (fiber->caller == NULL) {
+        runtimeError(vm, "Can't yield from the main script.");
+        return false;
+    }
+
+    vm->stackTop = slot; // yield()'s result is pushed here when the fiber is resumed.
+    saveFiber(vm);
+    fiber->state = FIBER_SUSPENDED;
+
+    ObjFiber* caller = fiber->caller;
+    fiber->caller = NULL;
+    loadFiber(vm, caller);
+    push(vm, value); // what resume() returns.
+    return true;
+}
+
+// replaces the instance on top of the stack with the named method, bound to it.
+static bool bindMethod(VM* vm, ObjClass* klass, ObjString* name) {
+    Value method;
+    if (!tableGet(&klass->methods, name, &method)) {
+        runtimeError(vm, "Undefined property '%s'.", name->chars);
+        return false;
+    }
+
+    ObjBoundMethod* bound = newBoundMethod(vm, peek(vm, 0), method);
+    pop(vm);
+    push(vm, OBJ_VAL(bound));
+    return true;
+}
+
+static void defineMethod(VM* vm, ObjString* name) {
+    Value method = peek(vm, 0);
+    ObjClass* klass = AS_CLASS(peek(vm, 1));
+    tableSet(&klass->methods, name, method);
+    // compared by content once here, so constructing an instance needs no lookup.
+    if (name->length == 4 && memcmp(name->chars, "init", 4) == 0) klass->initializer = method;
+    klass->version++;
+    pop(vm);
+}
+
+/*
+Finds what a method call site should call for a receiver of this shape and class.
+A hit is an entry with the same shape and class whose version is still the class's;
+an entry that is only out of date is refreshed in place rather than taking another way.
+The method is looked up in the class's table only on a miss.
+*/
+static MethodEntry* lookupMethod(VM* vm, MethodCache* cache, ObjShape* shape, ObjClass* klass, ObjString* name,
+                                 MethodEntry* scratch) {
+    MethodEntry* entry = NULL;
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->entries[i].shape == shape && cache->entries[i].klass == klass) {
+            entry = &cache->entries[i];
+            if (entry->version == klass->version) return entry;
+            break;
+        }
+    }
+
+    Value method;
+    if (!tableGet(&klass->methods, name, &method)) {
+        runtimeError(vm, "Undefined property '%s'.", name->chars);
+        return NULL;
+    }
+
+    if (entry == NULL) {
+        entry = cache->count < METHOD_CACHE_WAYS ? &cache->entries[cache->count++] : scratch;
+    }
+    entry->shape = shape;
+    entry->klass = klass;
+    entry->version = klass->version;
+    if (IS_CLOSURE(method)) {
+        entry->function = AS_CLOSURE(method)->function;
+        entry->upvalues = AS_CLOSURE(method)->upvalues;
+    } else {
+        entry->function = AS_FUNCTION(method);
+        entry->upvalues = NULL;
+    }
+    return entry;
+}
+
+// receiver.name(args): the receiver is already in the callee's slot, which is 'this' in the method.
+static bool invoke(VM* vm, MethodCache* cache, ObjString* name, int argCount) {
+    Value receiver = peek(vm, argCount);
+    if (!IS_INSTANCE(receiver)) {
+        runtimeError(vm, "Only instances have methods.");
+        return false;
+    }
+
+    ObjInstance* instance = AS_INSTANCE(receiver);
+    MethodEntry scratch;
+    // a cached shape is known to have no field by this name, so the field check is only for misses.
+    for (int i = 0; i < cache->count; i++) {
+        MethodEntry* entry = &cache->entries[i];
+        if (entry->shape == instance->shape && entry->klass == instance->klass &&
+            entry->version == instance->klass->version) {
+            return call(vm, entry->function, entry->upvalues, argCount);
+        }
+    }
+
+    // a field holding something callable shadows the method, as it does for a plain get.
+    int slot = shapeFind(instance->shape, name);
+    if (slot != -1) {
+        vm->stackTop[-argCount - 1] = instance->fields[slot];
+        return callValue(vm, instance->fields[slot], argCount);
+    }
+
+    MethodEntry* entry = lookupMethod(vm, cache, instance->shape, instance->klass, name, &scratch);
+    if (entry == NULL) return false;
+    return call(vm, entry->function, entry->upvalues, argCount);
+}
+
+static inline CacheEntry* probeCache(PropertyCache* cache, ObjShape* shape) {
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->entries[i].shape == shape) return &cache->entries[i];
+    }
+    return NULL;
+}
+
+// remembers what the slow path found, unless the site has already seen PROPERTY_CACHE_WAYS shapes.
+static CacheEntry* fillCache(PropertyCache* cache, CacheEntry* found) {
+    if (cache->count == PROPERTY_CACHE_WAYS) return found;
+    cache->entries[cache->count] = *found;
+    return &cache->entries[cache->count++];
+}
+
+// cache miss on a get: NULL if instances of this shape have no such field.
+static CacheEntry* resolveGet(PropertyCache* cache, ObjShape* shape, ObjString* name, CacheEntry* scratch) {
+    int slot = shapeFind(shape, name);
+    if (slot == -1) return NULL; // a method, or nothing; methods are found through the class.
+
+    scratch->shape = shape;
+    scratch->transition = NULL;
+    scratch->slot = slot;
+    return fillCache(cache, scratch);
+}
+
+// cache miss on a set: either an existing field, or a new one that moves the instance to a child shape.
+static CacheEntry* resolveSet(VM* vm, PropertyCache* cache, ObjShape* shape, ObjString* name, CacheEntry* scratch) {
+    scratch->shape = shape;
+    scratch->slot = shapeFind(shape, name);
+    scratch->transition = NULL;
+    if (scratch->slot == -1) {
+        scratch->transition = shapeTransition(vm, shape, name);
+        scratch->slot = scratch->transition->fieldCount - 1;
+    }
+    return fillCache(cache, scratch);
+}
+
+static void growFields(ObjInstance* instance, int fieldCount) {
+    if (fieldCount <= instance->fieldCapacity) return;
+
+    int oldCapacity = instance->fieldCapacity;
+    instance->fieldCapacity = GROW_CAPACITY(oldCapacity);
+    instance->fields = GROW_ARRAY(Value, instance->fields, oldCapacity, instance->fieldCapacity);
+    if (instance->fieldCapacity > instance->klass->fieldHint) {
+        instance->klass->fieldHint = instance->fieldCapacity;
+    }
+}
+
+// reuses the upvalue for a slot if one is already open, so every closure sees the same variable.
+static ObjUpvalue* captureUpvalue(VM* vm, Value* local) {
+    ObjUpvalue* prevUpvalue = NULL;
+    ObjUpvalue* upvalue = vm->openUpvalues;
+    while (upvalue != NULL && upvalue->location > local) {
+        prevUpvalue = upvalue;
+        upvalue = upvalue->next;
+    }
+
+    if (upvalue != NULL && upvalue->location == local) return upvalue;
+
+    ObjUpvalue* createdUpvalue = newUpvalue(vm, local);
+    createdUpvalue->next = upvalue;
+    if (prevUpvalue == NULL) {
+        vm->openUpvalues = createdUpvalue;
+    } else {
+        prevUpvalue->next = createdUpvalue;
+    }
+    return createdUpvalue;
+}
+
+// close every open upvalue for a slot at or above 'last'; they are all at the front of the list.
+static void closeUpvalues(VM* vm, Value* last) {
+    while (vm->openUpvalues != NULL && vm->openUpvalues->location >= last) {
+        ObjUpvalue* upvalue = vm->openUpvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        vm->openUpvalues = upvalue->next;
+    }
 }
 
 static bool isFalsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate() {
-    ObjString* b = AS_STRING(pop());
-    ObjString* a = AS_STRING(pop());
+bool checkMapKey(VM* vm, Value key) {
+    if (isHashableKey(key)) return true;
+    if (IS_NUMBER(key)) {
+        runtimeError(vm, "Map keys can't be NaN.");
+    } else {
+        runtimeError(vm, "Map keys must be numbers, strings, booleans or nil.");
+    }
+    return false;
+}
+
+// a whole number in [0, count): the index of an element.
+static inline bool checkIndex(VM* vm, Value index, int count, int* result) {
+    if (!IS_NUMBER(index)) {
+        runtimeError(vm, "Index must be a number.");
+        return false;
+    }
+    double number = AS_NUMBER(index);
+    // range first: casting NaN, an infinity or anything past INT_MAX to int is undefined.
+    // written so NaN, which fails every comparison, fails it too.
+    if (!(number >= 0 && number < count)) {
+        runtimeError(vm, "Index out of range.");
+        return false;
+    }
+    int i = (int)number;
+    if ((double)i != number) {
+        runtimeError(vm, "Index out of range.");
+        return false;
+    }
+    *result = i;
+    return true;
+}
+
+static bool getIndex(VM* vm) {
+    Value target = peek(vm, 1);
+    int i;
+    if (IS_NUMBER_ARRAY(target)) {
+        ObjNumberArray* array = AS_NUMBER_ARRAY(target);
+        if (!checkIndex(vm, peek(vm, 0), array->count, &i)) return false;
+        vm->stackTop[-2] = NUMBER_VAL(array->items[i]);
+    } else if (IS_ARRAY(target)) {
+        ValueArray* items = &AS_ARRAY(target)->items;
+        if (!checkIndex(vm, peek(vm, 0), items->count, &i)) return false;
+        vm->stackTop[-2] = items->values[i];
+    } else if (IS_MAP(target)) {
+        if (!checkMapKey(vm, peek(vm, 0))) return false;
+        // a missing key reads as nil; has() tells the two apart.
+        Value value;
+        if (!valueTableGet(&AS_MAP(target)->table, peek(vm, 0), &value)) value = NIL_VAL;
+        vm->stackTop[-2] = value;
+    } else {
+        runtimeError(vm, "Only arrays and maps can be indexed.");
+        return false;
+    }
+    vm->stackTop--;
+    return true;
+}
+
+static bool setIndex(VM* vm) {
+    Value target = peek(vm, 2);
+    Value value = peek(vm, 0);
+    int i;
+    if (IS_NUMBER_ARRAY(target)) {
+        ObjNumberArray* array = AS_NUMBER_ARRAY(target);
+        if (!checkIndex(vm, peek(vm, 1), array->count, &i)) return false;
+        if (!IS_NUMBER(value)) {
+            runtimeError(vm, "Number arrays can only hold numbers.");
+            return false;
+        }
+        array->items[i] = AS_NUMBER(value);
+    } else if (IS_ARRAY(target)) {
+        ValueArray* items = &AS_ARRAY(target)->items;
+        if (!checkIndex(vm, peek(vm, 1), items->count, &i)) return false;
+        items->values[i] = value;
+    } else if (IS_MAP(target)) {
+        if (!checkMapKey(vm, peek(vm, 1))) return false;
+        valueTableSet(&AS_MAP(target)->table, peek(vm, 1), value);
+    } else {
+        runtimeError(vm, "Only arrays and maps can be indexed.");
+        return false;
+    }
+    // the assignment's value replaces the array and the index.
+    vm->stackTop[-3] = value;
+    vm->stackTop -= 2;
+    return true;
+}
+
+#define NUMBER_TEXT_MAX 24 // more than the longest "%g" of a double, "-1.23457e+308".
+
+/*
+Joins the top count values into one string, the way print would show them.
+The buffer is sized once from the parts (numbers at their longest), numbers are formatted
+straight into it, and only the result is interned. Parts that are other objects, which
+are rare here, are turned into strings first.
+*/
+static void buildString(VM* vm, int count) {
+    Value* parts = vm->stackTop - count;
+    size_t capacity = 1;
+    for (int i = 0; i < count; i++) {
+        Value part = parts[i];
+        if (IS_OBJ(part) && !IS_STRING(part)) parts[i] = part = OBJ_VAL(valueToString(vm, part));
+
+        if (IS_STRING(part)) capacity += AS_STRING(part)->length;
+        else if (IS_NUMBER(part)) capacity += NUMBER_TEXT_MAX;
+        else capacity += 5; // "false"
+    }
+
+    char* chars = ALLOCATE(char, capacity);
+    int length = 0;
+    for (int i = 0; i < count; i++) {
+        Value part = parts[i];
+        if (IS_STRING(part)) {
+            memcpy(chars + length, AS_STRING(part)->chars, AS_STRING(part)->length);
+            length += AS_STRING(part)->length;
+        } else if (IS_NUMBER(part)) {
+            length += snprintf(chars + length, NUMBER_TEXT_MAX, "%g", AS_NUMBER(part));
+        } else {
+            const char* text = IS_NIL(part) ? "nil" : AS_BOOL(part) ? "true" : "false";
+            memcpy(chars + length, text, strlen(text));
+            length += (int)strlen(text);
+        }
+    }
+    chars[length] = '\0';
+    // takeString() owns exactly length + 1 bytes.
+    if ((size_t)length + 1 < capacity) chars = GROW_ARRAY(char, chars, capacity, length + 1);
+
+    vm->stackTop = parts;
+    push(vm, OBJ_VAL(takeString(vm, chars, length)));
+}
+
+static void concatenate(VM* vm) {
+    ObjString* b = AS_STRING(pop(vm));
+    ObjString* a = AS_STRING(pop(vm));
 
     int length = a->length + b->length;
     char* chars = ALLOCATE(char, length + 1);
@@ -69,11 +729,11 @@ static void concatenate() {
     memcpy(chars + a->length, b->chars, b->length);
     chars[length] = '\0';
 
-    ObjString* result = takeString(chars, length);
-    push(OBJ_VAL(result));
+    ObjString* result = takeString(vm, chars, length);
+    push(vm, OBJ_VAL(result));
 }
 
-static InterpreterResult run() {
+static InterpreterResult run(VM* vm) {
 /*
   * Given a numeric opcode, we need to get to the right C code that implements that instruction's semantics.
  * This process is called dispatching or decoding.
@@ -81,8 +741,11 @@ static InterpreterResult run() {
  * for keep it simple, we'll use a switch statement to dispatch to the right code.
  * other options: "direct threading", "jump table", "computed goto"
  * */
-#define READ_BYTE() (*vm.ip++) // vm.ip 의 값을 읽고, 그 다음 값을 가리키도록 증가시킴
-#define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
+    // the current frame; reloaded whenever a call or return changes it.
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];
+
+#define READ_BYTE() (*frame->ip++) // frame->ip 의 값을 읽고, 그 다음 값을 가리키도록 증가시킴
+#define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
 
 /* 
     yanks the next two bytes from the chunk and builds a 16-bit unsigned integer소
@@ -90,7 +753,7 @@ static InterpreterResult run() {
     16비트로 만들기 위해 첫 번째 8비트를 왼쪽으로 8비트 이동시키고, 두 번째 8비트를 더함.
 */
 #define READ_SHORT() \
-    (vm.ip += 2, (uint16_t)((vm.ip[-2] << 8) | vm.ip[-1]))
+    (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
 
 /*
     reads a one-byte operand from the bytecode chunk.
@@ -99,46 +762,62 @@ static InterpreterResult run() {
 #define READ_STRING() AS_STRING(READ_CONSTANT())
 #define BINARY_OP(valueType, op) \
     do { \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtimeError("Operands must be numbers."); \
+        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
+            runtimeError(vm, "Operands must be numbers."); \
             return INTERPRET_RUNTIME_ERROR; \
         } \
-        double b = AS_NUMBER(pop());\
-        double a = AS_NUMBER(pop()); \
-        push(valueType(a op b)); \
+        double b = AS_NUMBER(pop(vm));\
+        double a = AS_NUMBER(pop(vm)); \
+        push(vm, valueType(a op b)); \
+    } while (false)
+
+// the compiler proved both operands are numbers, so no tag checks; the result replaces the left operand in place.
+#define NUMBER_OP(valueType, op) \
+    do { \
+        vm->stackTop[-2] = valueType(AS_NUMBER(vm->stackTop[-2]) op AS_NUMBER(vm->stackTop[-1])); \
+        vm->stackTop--; \
     } while (false)
 
-    printf("== start interpret == \n");
+#ifdef PROFILE_OPCODES
+    profileStart();
+#endif
     for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
         printf("              ");
-        for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
             printf("[ ");
             printValue(*slot);
             printf(" ]");
         }
         printf("\n");
-        disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+        disassembleInstruction(&frame->function->chunk, (int)(frame->ip - frame->function->chunk.code));
+#endif
+#ifdef PROFILE_OPCODES
+        profileInstruction(*frame->ip);
 #endif
+        if (vm->recorder != NULL) {
+            traceInstruction(vm->recorder, frame->function->ordinal, (uint32_t)(frame->ip - frame->function->chunk.code),
+                             *frame->ip, vm->stack, vm->stackTop);
+        }
         uint8_t instruction;
         switch (instruction = READ_BYTE()) {
             case OP_CONSTANT: {
                 // [opcode], [constant index] 라 switch 문에서 opcode를 읽었고,
                 Value constant = READ_CONSTANT(); // 그 다음 바이트를 읽어서 constant value를 가져옴
-                push(constant);
+                push(vm, constant);
                 break;
             }
-            case OP_NIL: push(NIL_VAL); break;
-            case OP_TRUE: push(BOOL_VAL(true)); break;
-            case OP_FALSE: push(BOOL_VAL(false)); break;
-            case OP_POP: pop(); break;
+            case OP_NIL: push(vm, NIL_VAL); break;
+            case OP_TRUE: push(vm, BOOL_VAL(true)); break;
+            case OP_FALSE: push(vm, BOOL_VAL(false)); break;
+            case OP_POP: pop(vm); break;
             case OP_GET_LOCAL: {
                 // takes a single-byte operand for the stack slot where the local lives.
                 // It loads the value from that index and then pushes it on top of the stack.
 
                 // GET인데 왜 push 인가? - 값을 가져와서 stack에 push 해서 가져가 쓸 수 있도록 함. 
                 uint8_t slot = READ_BYTE();
-                push(vm.stack[slot]); // OP_SET_LOCAL에서 설정한 값
+                push(vm, frame->slots[slot]); // OP_SET_LOCAL에서 설정한 값
                 break;
             }
             /* 
@@ -149,51 +828,130 @@ static InterpreterResult run() {
             */
             case OP_SET_LOCAL: {
                 uint8_t slot = READ_BYTE();
-                vm.stack[slot] = peek(0);
+                frame->slots[slot] = peek(vm, 0);
                 break;
             }
             case OP_GET_GLOBAL: {
                 ObjString* name = READ_STRING();
                 Value value;
-                if (!tableGet(&vm.globals, name, &value)) {
-                    runtimeError("Undefined variable '%s'.", name->chars);
+                if (!tableGet(&vm->globals, name, &value)) {
+                    runtimeError(vm, "Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(value);
+                push(vm, value);
                 break;
             }
             case OP_DEFINE_GLOBAL: {
                 ObjString* name = READ_STRING();
-                tableSet(&vm.globals, name, peek(0));
-                pop();
+                tableSet(&vm->globals, name, peek(vm, 0));
+                pop(vm);
                 break;
             }
             case OP_SET_GLOBAL: {
                 ObjString* name = READ_STRING();
-                if (tableSet(&vm.globals, name, peek(0))) {
-                    tableDelete(&vm.globals, name);
-                    runtimeError("Undefined variable '%s'.", name->chars);
+                if (tableSet(&vm->globals, name, peek(vm, 0))) {
+                    tableDelete(&vm->globals, name);
+                    runtimeError(vm, "Undefined variable '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_GET_UPVALUE: {
+                uint8_t slot = READ_BYTE();
+                push(vm, *frame->upvalues[slot]->location);
+                break;
+            }
+            case OP_SET_UPVALUE: {
+                uint8_t slot = READ_BYTE();
+                *frame->upvalues[slot]->location = peek(vm, 0);
+                break;
+            }
+            case OP_GET_PROPERTY: {
+                if (!IS_INSTANCE(peek(vm, 0))) {
+                    runtimeError(vm, "Only instances have properties.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                ObjInstance* instance = AS_INSTANCE(peek(vm, 0));
+                ObjString* name = READ_STRING();
+                PropertyCache* cache = &frame->function->chunk.caches[READ_SHORT()];
+                CacheEntry scratch;
+                CacheEntry* entry = probeCache(cache, instance->shape);
+                if (entry == NULL) entry = resolveGet(cache, instance->shape, name, &scratch);
+
+                if (entry != NULL) {
+                    vm->stackTop[-1] = instance->fields[entry->slot];
+                    break;
+                }
+                // fields shadow methods, so only now look at the class.
+                if (!bindMethod(vm, instance->klass, name)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_SET_PROPERTY: {
+                if (!IS_INSTANCE(peek(vm, 1))) {
+                    runtimeError(vm, "Only instances have fields.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
+
+                ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
+                ObjString* name = READ_STRING();
+                PropertyCache* cache = &frame->function->chunk.caches[READ_SHORT()];
+                CacheEntry scratch;
+                CacheEntry* entry = probeCache(cache, instance->shape);
+                if (entry == NULL) entry = resolveSet(vm, cache, instance->shape, name, &scratch);
+
+                if (entry->transition != NULL) {
+                    growFields(instance, entry->transition->fieldCount);
+                    instance->shape = entry->transition;
+                }
+                instance->fields[entry->slot] = peek(vm, 0);
+                // the assignment's value replaces the instance.
+                vm->stackTop[-2] = vm->stackTop[-1];
+                vm->stackTop--;
+                break;
+            }
+            case OP_BUILD_ARRAY: {
+                int count = READ_BYTE();
+                ObjArray* array = newArray(vm);
+                // sized exactly: a literal's length is known, and most are never grown.
+                if (count > 0) {
+                    array->items.values = ALLOCATE(Value, count);
+                    array->items.capacity = count;
+                    array->items.count = count;
+                    memcpy(array->items.values, vm->stackTop - count, sizeof(Value) * count);
+                }
+                vm->stackTop -= count;
+                push(vm, OBJ_VAL(array));
                 break;
             }
+            case OP_BUILD_STRING:
+                buildString(vm, READ_BYTE());
+                break;
+            case OP_GET_INDEX:
+                if (!getIndex(vm)) return INTERPRET_RUNTIME_ERROR;
+                break;
+            case OP_SET_INDEX:
+                if (!setIndex(vm)) return INTERPRET_RUNTIME_ERROR;
+                break;
             case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
+                Value b = pop(vm);
+                Value a = pop(vm);
+                push(vm, BOOL_VAL(valuesEqual(a, b)));
                 break;
             }
             case OP_GREATER: BINARY_OP(BOOL_VAL, >); break;
             case OP_LESS: BINARY_OP(BOOL_VAL, <); break;
             case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                    concatenate();
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(pop());
-                    double a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a + b));
+                if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
+                    concatenate(vm);
+                } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
+                    double b = AS_NUMBER(pop(vm));
+                    double a = AS_NUMBER(pop(vm));
+                    push(vm, NUMBER_VAL(a + b));
                 } else {
-                    runtimeError("Operands must be two numbers or two strings.");
+                    runtimeError(vm, "Operands must be two numbers or two strings.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
@@ -202,43 +960,204 @@ static InterpreterResult run() {
             case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
             case OP_DIVIDE: BINARY_OP(NUMBER_VAL, /); break;
             case OP_NOT:
-                push(BOOL_VAL(isFalsey(pop())));
+                push(vm, BOOL_VAL(isFalsey(pop(vm))));
                 break;
             case OP_NEGATE: {
-                if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
+                if (!IS_NUMBER(peek(vm, 0))) {
+                    runtimeError(vm, "Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
+                push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
                 break;
             }
+            case OP_ADD_NUM: NUMBER_OP(NUMBER_VAL, +); break;
+            case OP_SUBTRACT_NUM: NUMBER_OP(NUMBER_VAL, -); break;
+            case OP_MULTIPLY_NUM: NUMBER_OP(NUMBER_VAL, *); break;
+            case OP_DIVIDE_NUM: NUMBER_OP(NUMBER_VAL, /); break;
+            case OP_GREATER_NUM: NUMBER_OP(BOOL_VAL, >); break;
+            case OP_LESS_NUM: NUMBER_OP(BOOL_VAL, <); break;
+            case OP_NEGATE_NUM:
+                vm->stackTop[-1] = NUMBER_VAL(-AS_NUMBER(vm->stackTop[-1]));
+                break;
             case OP_PRINT: {
-                printValue(pop());
-                printf("\n");
+                fprintValue(vm->out, pop(vm));
+                fprintf(vm->out, "\n");
                 break;
             }
             case OP_JUMP: {
                 uint16_t offset = READ_SHORT();
-                vm.ip += offset;
+                frame->ip += offset;
                 break;
             }
             case OP_JUMP_IF_FALSE: {
                 uint16_t offset = READ_SHORT();
-                if (isFalsey(peek(0))) vm.ip += offset;
+                if (isFalsey(peek(vm, 0))) frame->ip += offset;
                 break;
             }
             case OP_LOOP: {
                 uint16_t offset = READ_SHORT();
-                vm.ip -= offset;
+                frame->ip -= offset;
+                // every loop iteration passes through here, so this is the one place a script can run for long.
+                vm->budget -= offset;
+                if (vm->budget < 0) return INTERPRET_YIELD;
+                break;
+            }
+            case OP_TABLE_SWITCH: {
+                SwitchTable* table = &frame->function->chunk.switches[READ_SHORT()];
+                Value value = pop(vm);
+                int target = table->defaultTarget;
+                if (IS_NUMBER(value)) {
+                    // NaN fails the range check; a fraction fails the whole-number one.
+                    double index = AS_NUMBER(value) - table->low;
+                    if (index >= 0 && index < table->count && index == (int)index) target = table->targets[(int)index];
+                }
+                frame->ip += target;
                 break;
             }
+            case OP_LOOKUP_SWITCH: {
+                SwitchTable* table = &frame->function->chunk.switches[READ_SHORT()];
+                Value value = pop(vm);
+                Value target;
+                if (!isHashableKey(value) || !valueTableGet(&table->labels, value, &target)) {
+                    target = NUMBER_VAL(table->defaultTarget);
+                }
+                frame->ip += (int)AS_NUMBER(target);
+                break;
+            }
+            case OP_CALL: {
+                int argCount = READ_BYTE();
+                if (!callValue(vm, peek(vm, argCount), argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm->frames[vm->frameCount - 1];
+                // yield with the callee's frame pushed; resuming starts on its first instruction.
+                if (vm->budget < 0) return INTERPRET_YIELD;
+                break;
+            }
+            case OP_CALL_NUM: {
+                int argCount = READ_BYTE();
+                Value callee = peek(vm, argCount);
+                /*
+                The compiler proved every argument a number, so a typed native whose arity
+                matches is called straight away: no argument checks, no boxing until the result.
+                */
+                if (IS_NATIVE(callee)) {
+                    ObjNative* native = AS_NATIVE(callee);
+                    if (native->signature == NATIVE_UNARY && argCount == 1) {
+                        vm->stackTop[-2] = NUMBER_VAL(native->as.unary(AS_NUMBER(vm->stackTop[-1])));
+                        vm->stackTop -= 1;
+                        break;
+                    }
+                    if (native->signature == NATIVE_BINARY && argCount == 2) {
+                        vm->stackTop[-3] = NUMBER_VAL(native->as.binary(AS_NUMBER(vm->stackTop[-2]),
+                                                                        AS_NUMBER(vm->stackTop[-1])));
+                        vm->stackTop -= 2;
+                        break;
+                    }
+                }
+                // anything else is called as by OP_CALL.
+                if (!callValue(vm, callee, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm->frames[vm->frameCount - 1];
+                if (vm->budget < 0) return INTERPRET_YIELD;
+                break;
+            }
+            case OP_INVOKE: {
+                ObjString* name = READ_STRING();
+                int argCount = READ_BYTE();
+                MethodCache* cache = &frame->function->chunk.methodCaches[READ_SHORT()];
+                if (!invoke(vm, cache, name, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm->frames[vm->frameCount - 1];
+                if (vm->budget < 0) return INTERPRET_YIELD;
+                break;
+            }
+            case OP_SUPER_INVOKE: {
+                ObjString* name = READ_STRING();
+                int argCount = READ_BYTE();
+                MethodCache* cache = &frame->function->chunk.methodCaches[READ_SHORT()];
+                ObjClass* superclass = AS_CLASS(pop(vm));
+                // no field can shadow a super call, so the entries are keyed by class alone.
+                MethodEntry scratch;
+                MethodEntry* entry = lookupMethod(vm, cache, NULL, superclass, name, &scratch);
+                if (entry == NULL || !call(vm, entry->function, entry->upvalues, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm->frames[vm->frameCount - 1];
+                if (vm->budget < 0) return INTERPRET_YIELD;
+                break;
+            }
+            case OP_CLOSURE: {
+                ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+                ObjClosure* closure = newClosure(vm, function);
+                push(vm, OBJ_VAL(closure));
+                for (int i = 0; i < closure->upvalueCount; i++) {
+                    uint8_t isLocal = READ_BYTE();
+                    uint8_t index = READ_BYTE();
+                    closure->upvalues[i] = isLocal ? captureUpvalue(vm, frame->slots + index) : frame->upvalues[index];
+                }
+                break;
+            }
+            case OP_CLASS:
+                push(vm, OBJ_VAL(newClass(vm, READ_STRING())));
+                break;
+            case OP_INHERIT: {
+                Value superclass = peek(vm, 1);
+                if (!IS_CLASS(superclass)) {
+                    runtimeError(vm, "Superclass must be a class.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                // copy-down inheritance: the subclass's own methods, defined next, overwrite these.
+                ObjClass* subclass = AS_CLASS(peek(vm, 0));
+                tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
+                subclass->initializer = AS_CLASS(superclass)->initializer;
+                subclass->fieldHint = AS_CLASS(superclass)->fieldHint;
+                subclass->version++;
+                pop(vm); // the superclass stays, as the local 'super'.
+                break;
+            }
+            case OP_METHOD:
+                defineMethod(vm, READ_STRING());
+                break;
+            case OP_GET_SUPER: {
+                ObjString* name = READ_STRING();
+                ObjClass* superclass = AS_CLASS(pop(vm));
+                if (!bindMethod(vm, superclass, name)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_CLOSE_UPVALUE:
+                closeUpvalues(vm, vm->stackTop - 1);
+                pop(vm);
+                break;
             case OP_RETURN: {
-                // for real func, have to change this.
-                // but for now, just print the value.
-                printValue(pop());
-                printf("\n");
-                return INTERPRET_OK;
-                
+                /*
+                The result replaces the callee and its whole slot window, so tearing the frame
+                down is one store to stackTop and one decrement.
+                */
+                Value result = pop(vm);
+                closeUpvalues(vm, frame->slots);
+                vm->frameCount--;
+                if (vm->frameCount == 0) {
+                    if (vm->fiber == vm->mainFiber) {
+                        pop(vm); // the script function itself.
+                        return INTERPRET_OK;
+                    }
+                    // a fiber's function returned: that is what resume() returns in its caller.
+                    endFiber(vm);
+                    push(vm, result);
+                    frame = &vm->frames[vm->frameCount - 1];
+                    break;
+                }
+
+                vm->stackTop = frame->slots;
+                push(vm, result);
+                frame = &vm->frames[vm->frameCount - 1];
+                break;
             }
         }
     }
@@ -247,29 +1166,53 @@ static InterpreterResult run() {
 #undef READ_CONSTANT
 #undef READ_STRING
 #undef BINARY_OP
+#undef NUMBER_OP
 }
 
 /*
-create a new empty chunk and pass it over to the compiler. 
-The compiler will take the user’s program and fill up the chunk with bytecode.
+The compiler turns the user's program into a function for the top-level code.
+If it does encounter an error, compile() returns NULL.
 
-If it does encounter an error, compile() returns false and discard the unusable chunk.
+The script function goes into stack slot 0 and gets the first call frame, exactly like a call
+made from Lox, so it can be run in several slices.
 */
-InterpreterResult interpret(const char* source) {
-    Chunk chunk;
-    initChunk(&chunk);
-    if (!compile(source, &chunk)) {
-        freeChunk(&chunk);
-        return INTERPRET_COMPILE_ERROR;
+InterpreterResult loadScript(VM* vm, const char* source, size_t length) {
+    ObjFunction* function = compile(vm, source, length, NULL);
+    if (function == NULL) return INTERPRET_COMPILE_ERROR;
+
+    // the compiler knows the deepest the top-level code goes, so a script that can't fit is refused up front.
+    if (function->chunk.maxStackDepth > vm->stackCapacity - (int)(vm->stackTop - vm->stack)) {
+        fprintf(vm->err, "Stack overflow: script needs %d stack slots.\n", function->chunk.maxStackDepth);
+        return INTERPRET_RUNTIME_ERROR;
     }
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
+    push(vm, OBJ_VAL(function));
+    call(vm, function, NULL, 0);
+    return INTERPRET_OK;
+}
 
-    InterpreterResult result = run();
+InterpreterResult resumeScript(VM* vm, long budget) {
+    vm->budget = budget;
 
-    freeChunk(&chunk);
-    complie(source);
+    beginSampledRun(vm);
+    InterpreterResult result;
+    sigjmp_buf overflow;
+    if (sigsetjmp(overflow, 1) == 0) {
+        stackOverflowJump = &overflow;
+        runningVM = vm;
+        result = run(vm);
+    } else {
+        // a push landed on the guard page.
+        runtimeError(vm, "Stack overflow.");
+        result = INTERPRET_RUNTIME_ERROR;
+    }
+    runningVM = NULL;
+    endSampledRun(vm);
+    return result;
+}
 
-    return INTERPRET_OK;
+InterpreterResult interpret(VM* vm, const char* source, size_t length) {
+    InterpreterResult result = loadScript(vm, source, length);
+    if (result != INTERPRET_OK) return result;
+    return resumeScript(vm, BUDGET_UNLIMITED);
 }
@@ -1,43 +1,138 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
-#include "chunk.h"
+#include <limits.h>
+
+#include "fiber.h"
+#include "object.h"
 #include "table.h"
 #include "value.h"
 
-#define STACK_MAX 256
+typedef struct FlightRecorder FlightRecorder;
+
+#define BUDGET_UNLIMITED LONG_MAX
 
-typedef struct {
-    Chunk* chunk;
+#define STACK_MAX (1024 * 1024) // values reserved for the stack; pages are only committed when touched.
+#define FRAMES_MAX 1024 // deepest call nesting, in the main script and in every fiber.
 
+/*
+One ongoing function call.
+Frames live in one contiguous array per fiber, so a call only fills in the next element:
+no allocation, and the frames near the top stay in the same few cache lines.
+*/
+typedef struct CallFrame {
+    ObjFunction* function;
+    ObjUpvalue** upvalues; // the closure's captured variables; NULL when a bare function is running.
     /*
     ip: instruction pointer at x86, x64, CLR.
     68k, PowerPC, ARM, p-code, JVM call it the program counter (PC).
 
     ip points to the instruction that is about to be executed.
     always points to the next instruction, not the one currently being handled.
+    Each frame keeps its own, so returning resumes the caller where it left off.
     */
     uint8_t* ip;
-    Value stack[STACK_MAX];
+    /*
+    The frame's window into vm.stack: slots[0] is the callee itself, then the arguments,
+    then the locals. The caller pushed the arguments right where the callee's parameters
+    live, so calling copies nothing.
+    */
+    Value* slots;
+} CallFrame;
+
+typedef struct VM {
+    /*
+    frames, stack and openUpvalues are the running fiber's (see ObjFiber); a fiber switch
+    stores them back into the fiber it leaves and loads the other's.
+    */
+    CallFrame* frames;
+    int frameCount; // 0 when no script is loaded.
+
+    /*
+    What the script may still run before run() yields, in bytes of bytecode.
+    It is charged at backward jumps (OP_LOOP), with the length of the loop body, and at calls,
+    with the length of the callee's code, so straight-line code costs nothing to meter
+    and only loops and recursion can exhaust it.
+    */
+    long budget;
+    Value* stack;
+    int stackCapacity;
     Value* stackTop;
     Table globals;
     Table strings;
+    /*
+    Optional read-only intern table shared by many VMs (see --prelude).
+    copyString()/takeString() look a string up here before the private strings table and
+    never add to it, so a given text always resolves to one ObjString* inside a VM and
+    pointer equality still means string equality. It must be fully built before the VMs
+    using it start, and never changes afterwards, so reading it needs no lock.
+    */
+    const Table* sharedStrings;
+
+    /*
+    Upvalues still pointing into the stack, sorted from the highest slot down.
+    Closing them all at or above a slot only has to look at the front of the list,
+    and capturing a variable that is already captured finds it without scanning far.
+    */
+    ObjUpvalue* openUpvalues;
+    ObjFiber* fiber;      // the one running.
+    ObjFiber* mainFiber;  // the script's; it never finishes or yields.
+    FiberPool fiberPool;
+    ObjShape* emptyShape; // root of the shape tree; every new instance starts here.
 
     Obj* objects; // pointer to the head of the list
+    FlightRecorder* recorder; // NULL unless --trace is recording this VM.
+    FILE* out; // print statements; stdout unless a runner captures the script's output.
+    FILE* err; // compile and runtime errors; stderr unless captured.
 } VM;
 
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
+    INTERPRET_RUNTIME_ERROR,
+    INTERPRET_YIELD // out of budget; resumeScript() picks up where it stopped.
 } InterpreterResult;
 
-extern VM vm;  // expose external
+/*
+A VM owns everything a running script touches: stack, globals, interned strings, objects.
+There is no global VM, so separate VMs can run on separate threads.
+sharedStrings may be NULL; it has to be given here because initVM() already interns
+the names of the native functions it defines.
+*/
+void initVM(VM* vm, const Table* sharedStrings);
+void freeVM(VM* vm);
+// compile and run to completion.
+InterpreterResult interpret(VM* vm, const char* source, size_t length);
+
+/*
+Run a script in slices: loadScript() compiles it into the VM, and each resumeScript()
+runs until the script ends, fails, or has spent budget (INTERPRET_YIELD).
+A yielded VM keeps its frames and stack, so any later resumeScript() continues it.
+*/
+InterpreterResult loadScript(VM* vm, const char* source, size_t length);
+InterpreterResult resumeScript(VM* vm, long budget);
+void push(VM* vm, Value value);
+Value pop(VM* vm);
+
+/*
+Native functions are defined as globals. arity -1 accepts any number of arguments.
+The typed forms are called with unboxed doubles; see ObjNative.
+*/
+void defineNative(VM* vm, const char* name, int arity, NativeFn function);
+void defineUnaryNative(VM* vm, const char* name, UnaryNativeFn function);
+void defineBinaryNative(VM* vm, const char* name, BinaryNativeFn function);
+// reports a runtime error with a stack trace; for natives, which then return false.
+void runtimeError(VM* vm, const char* format, ...);
+// reports the error if the value can't be a map key (see isHashableKey()).
+bool checkMapKey(VM* vm, Value key);
 
-void initVM();
-void freeVM();
-InterpreterResult interpret(const char* source);
-void push(Value value);
-Value pop();
+/*
+Fiber switches, for the natives resume() and yield(). They are called with the native's
+slot (args[-1]) and arguments still on the stack; those are dropped from the fiber being
+left, and the value it is eventually resumed with, or returned to, goes in their place.
+The native then returns true without writing a result.
+*/
+bool resumeFiber(VM* vm, ObjFiber* fiber, Value value, Value* slot);
+bool yieldFiber(VM* vm, Value value, Value* slot);
 
 #endif
\ No newline at end of file